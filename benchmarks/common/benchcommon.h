@@ -0,0 +1,214 @@
+//
+// benchcommon.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_BENCHCOMMON_H
+#define THINKERQT_BENCHCOMMON_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+
+#include "thinkerqt/thinker.h"
+
+//
+// Pieces shared by the programs under benchmarks/, so that they measure
+// snapshot contention the same way and print results in the same shape.
+//
+
+
+//
+// BenchRecord
+//
+// One result, written to stdout as a single-line JSON object when the
+// record goes out of scope.  The first field names what was measured, and
+// every record says whether the library's checks were compiled in, so the
+// output of a normal build and a THINKERQT_NO_CHECKS build can be told
+// apart once they are merged.
+//
+
+class BenchRecord
+{
+public:
+    BenchRecord (char const * key, char const * value) :
+        _out (stdout)
+    {
+        _out << "{\"" << key << "\":\"" << value << "\""
+            << ",\"checks\":\"" << (THINKERQT_NO_CHECKS ? "off" : "on")
+            << "\"";
+    }
+
+    BenchRecord (BenchRecord const & other) = delete;
+    BenchRecord & operator= (BenchRecord const & other) = delete;
+
+    ~BenchRecord () {
+        _out << "}\n";
+    }
+
+public:
+    BenchRecord & text (char const * key, char const * value) {
+        _out << ",\"" << key << "\":\"" << value << "\"";
+        return *this;
+    }
+
+    BenchRecord & integer (char const * key, qint64 value) {
+        _out << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    BenchRecord & real (char const * key, double value) {
+        _out << ",\"" << key << "\":" << QString::number(value, 'f', 3);
+        return *this;
+    }
+
+    // Summarizes nanosecond timings by percentile; the tail is usually
+    // what a regression shows up in first, so the mean alone won't do
+    BenchRecord & latencies (QVector<qint64> samples) {
+        text("unit", "ns");
+        integer("samples", samples.size());
+        if (samples.isEmpty())
+            return *this;
+
+        std::sort(samples.begin(), samples.end());
+
+        qint64 total = 0;
+        for (qint64 sample : samples)
+            total += sample;
+
+        int count = samples.size();
+        auto percentile = [&] (int perThousand) {
+            return samples[qMin(count - 1, (count * perThousand) / 1000)];
+        };
+
+        return integer("min", samples.first())
+            .integer("p50", percentile(500))
+            .integer("p99", percentile(990))
+            .integer("p999", percentile(999))
+            .integer("max", samples.last())
+            .integer("mean", total / count);
+    }
+
+private:
+    QTextStream _out;
+};
+
+
+
+//
+// CounterData, WriterThinker
+//
+// A writer bumps its counter under the write lock as fast as it can until
+// canceled, which is the worst case for anyone taking snapshots of it.
+//
+
+class CounterData : public SnapshottableData
+{
+public:
+    CounterData () :
+        counter (0)
+    {
+    }
+
+    quint64 counter;
+};
+
+
+class WriterThinker : public Thinker<CounterData>
+{
+protected:
+    bool start () override {
+        while (not wasPauseRequested()) {
+            lockForWrite();
+            writable().counter++;
+            unlock();
+        }
+        return false;
+    }
+};
+
+
+
+//
+// SnapshotReader
+//
+// A thread that snapshots a writer until a deadline on the given clock,
+// counting how many it took.  If sampleEvery is nonzero, the latency of
+// one createSnapshot() call in that many is kept as well; keeping them all
+// would have a long run collect hundreds of millions of samples.
+//
+
+class SnapshotReader : public QThread
+{
+public:
+    SnapshotReader (
+        WriterThinker::Present const & present,
+        QElapsedTimer const & clock,
+        qint64 until,
+        int sampleEvery = 0
+    ) :
+        QThread (),
+        _present (present),
+        _clock (clock),
+        _until (until),
+        _sampleEvery (sampleEvery),
+        _snapshots (0)
+    {
+    }
+
+    qint64 snapshots () const {
+        return _snapshots;
+    }
+
+    QVector<qint64> const & samples () const {
+        return _samples;
+    }
+
+protected:
+    void run () override {
+        // Presents must be destroyed on the thread that made them
+        WriterThinker::Present present (_present);
+
+        while (true) {
+            qint64 then = _clock.nsecsElapsed();
+            if (then >= _until)
+                break;
+
+            WriterThinker::Snapshot snapshot = present.createSnapshot();
+            static_cast<void>(snapshot->counter);
+
+            if ((_sampleEvery != 0) and (_snapshots % _sampleEvery == 0))
+                _samples.append(_clock.nsecsElapsed() - then);
+            _snapshots++;
+        }
+    }
+
+private:
+    WriterThinker::Present const & _present;
+    QElapsedTimer const & _clock;
+    qint64 const _until;
+    int const _sampleEvery;
+    qint64 _snapshots;
+    QVector<qint64> _samples;
+};
+
+#endif
@@ -0,0 +1,426 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+#include <QtAlgorithms>
+#include <climits>
+
+#include "thinkerqt/thinker.h"
+#include "thinkerqt/thinkermanager.h"
+#include "thinkerqt/signalthrottler.h"
+
+#include "benchcommon.h"
+
+//
+// thinkerbench
+//
+// Microbenchmarks for the library's hot paths.  Each result is printed as
+// one JSON object per line on stdout, so runs against different versions
+// can be diffed or loaded into a spreadsheet to spot regressions.  Pass
+// --quick for a smoke run with a tenth of the iterations.
+//
+// To see what the library's checks cost, build once as usual and once with
+// "qmake CONFIG+=thinkerqt_no_checks" (see THINKERQT_NO_CHECKS in defs.h).
+// Every line says which it came from.
+//
+
+namespace {
+
+QElapsedTimer benchClock; // started in main(), read from every thread
+
+int iterationDivisor = 1;
+
+int iterations (int count) {
+    return qMax(1, count / iterationDivisor);
+}
+
+
+void report (char const * benchmark, QVector<qint64> const & samples) {
+    BenchRecord ("benchmark", benchmark).latencies(samples);
+}
+
+
+void report (
+    char const * benchmark,
+    char const * unit,
+    double value,
+    char const * parameter = nullptr,
+    int parameterValue = 0
+) {
+    BenchRecord record ("benchmark", benchmark);
+    if (parameter != nullptr)
+        record.integer(parameter, parameterValue);
+    record.text("unit", unit).real("value", value);
+}
+
+
+// Thread pushes are done by the manager thread, which is this one, so
+// anything waiting on a thinker to get going has to keep events moving
+
+template <class PresentType>
+void waitForFirstWrite (PresentType & present) {
+    while (present.version() == 0)
+        QCoreApplication::processEvents();
+}
+
+
+
+//
+// run() to start() latency
+//
+
+class StampData : public SnapshottableData
+{
+public:
+    StampData () :
+        startedAt (0)
+    {
+    }
+
+    qint64 startedAt;
+};
+
+
+class StampThinker : public Thinker<StampData>
+{
+protected:
+    bool start () override {
+        lockForWrite();
+        writable().startedAt = benchClock.nsecsElapsed();
+        unlock();
+        return true;
+    }
+};
+
+
+void benchRunToStart () {
+    QVector<qint64> samples;
+
+    for (int i = 0; i < iterations(2000); i++) {
+        qint64 runAt = benchClock.nsecsElapsed();
+        StampThinker::Present present = ThinkerQt::run<StampThinker>();
+        present.waitForFinished();
+
+        samples.append(present.createSnapshot()->startedAt - runAt);
+        QCoreApplication::processEvents(); // let finished thinkers go
+    }
+
+    report("run_to_start", samples);
+}
+
+
+
+//
+// wasPauseRequested() poll cost
+//
+
+class PollData : public SnapshottableData
+{
+public:
+    PollData () :
+        nsecs (0)
+    {
+    }
+
+    qint64 nsecs;
+};
+
+
+class PollThinker : public Thinker<PollData>
+{
+public:
+    PollThinker (int polls) :
+        Thinker (),
+        _polls (polls)
+    {
+    }
+
+protected:
+    bool start () override {
+        qint64 startedAt = benchClock.nsecsElapsed();
+        for (int i = 0; i < _polls; i++) {
+            if (wasPauseRequested())
+                return false;
+        }
+
+        lockForWrite();
+        writable().nsecs = benchClock.nsecsElapsed() - startedAt;
+        unlock();
+        return true;
+    }
+
+private:
+    int _polls;
+};
+
+
+void benchPollCost () {
+    int const polls = iterations(10000000);
+
+    PollThinker::Present present = ThinkerQt::run<PollThinker>(polls);
+    present.waitForFinished();
+
+    report(
+        "was_pause_requested",
+        "ns/poll",
+        static_cast<double>(present.createSnapshot()->nsecs) / polls
+    );
+}
+
+
+
+//
+// pause/resume and cancel round trips
+//
+
+class SpinData : public SnapshottableData
+{
+};
+
+
+class SpinThinker : public Thinker<SpinData>
+{
+protected:
+    bool start () override {
+        // Publishing a version tells the benchmark we're up and running
+        lockForWrite();
+        unlock();
+        return spin();
+    }
+
+    bool resume () override {
+        return spin();
+    }
+
+private:
+    bool spin () {
+        while (not wasPauseRequested()) {
+        }
+        return false;
+    }
+};
+
+
+void benchPauseResume () {
+    SpinThinker::Present present = ThinkerQt::run<SpinThinker>();
+    waitForFirstWrite(present);
+
+    QVector<qint64> samples;
+    for (int i = 0; i < iterations(2000); i++) {
+        // Resuming waits for the thinker to actually reach Paused first
+        qint64 requestedAt = benchClock.nsecsElapsed();
+        present.pause();
+        present.resumeMaybeEmitDone();
+        samples.append(benchClock.nsecsElapsed() - requestedAt);
+    }
+
+    present.cancel();
+    present.waitForFinished();
+
+    report("pause_resume_round_trip", samples);
+}
+
+
+void benchCancel () {
+    QVector<qint64> samples;
+
+    for (int i = 0; i < iterations(500); i++) {
+        SpinThinker::Present present = ThinkerQt::run<SpinThinker>();
+        waitForFirstWrite(present);
+
+        qint64 requestedAt = benchClock.nsecsElapsed();
+        present.cancel();
+        present.waitForFinished();
+        samples.append(benchClock.nsecsElapsed() - requestedAt);
+
+        QCoreApplication::processEvents();
+    }
+
+    report("cancel_round_trip", samples);
+}
+
+
+
+//
+// Snapshot creation under contention with a writing thinker
+//
+
+void benchSnapshotContention () {
+    qint64 const duration = 1000000000 / iterationDivisor;
+
+    QVector<int> readerCounts;
+    for (int readers = 1; readers <= QThread::idealThreadCount(); readers *= 2)
+        readerCounts.append(readers);
+
+    for (int readers : readerCounts) {
+        WriterThinker::Present present = ThinkerQt::run<WriterThinker>();
+        waitForFirstWrite(present);
+
+        qint64 until = benchClock.nsecsElapsed() + duration;
+
+        QVector<SnapshotReader *> threads;
+        for (int i = 0; i < readers; i++) {
+            threads.append(new SnapshotReader (present, benchClock, until));
+            threads.last()->start();
+        }
+
+        qint64 total = 0;
+        for (SnapshotReader * thread : threads) {
+            thread->wait();
+            total += thread->snapshots();
+        }
+        qDeleteAll(threads);
+
+        present.cancel();
+        present.waitForFinished();
+
+        report(
+            "snapshot_throughput",
+            "snapshots/s",
+            total * 1000000000.0 / duration,
+            "readers",
+            readers
+        );
+    }
+}
+
+
+
+//
+// SignalThrottler
+//
+
+void benchThrottler () {
+    SignalThrottler throttler (100);
+
+    int const emits = iterations(1000000);
+
+    qint64 startedAt = benchClock.nsecsElapsed();
+    for (int i = 0; i < emits; i++)
+        throttler.emitThrottled();
+    qint64 nsecs = benchClock.nsecsElapsed() - startedAt;
+
+    QCoreApplication::processEvents();
+
+    report(
+        "throttler_emit",
+        "ns/call",
+        static_cast<double>(nsecs) / emits
+    );
+}
+
+
+
+//
+// Cost of a write as the number of watchers grows
+//
+
+class FanOutThinker : public Thinker<PollData>
+{
+public:
+    FanOutThinker (int writes) :
+        Thinker (),
+        _writes (writes)
+    {
+    }
+
+protected:
+    bool start () override {
+        // Wait to be told that the watchers are all attached
+        bool go = false;
+        while (not takeMessage(go)) {
+            if (wasPauseRequested(ULONG_MAX))
+                return false;
+        }
+
+        qint64 startedAt = benchClock.nsecsElapsed();
+        for (int i = 0; i < _writes; i++) {
+            lockForWrite();
+            writable().nsecs = i;
+            unlock();
+        }
+        qint64 nsecs = benchClock.nsecsElapsed() - startedAt;
+
+        lockForWrite();
+        writable().nsecs = nsecs;
+        unlock();
+        return true;
+    }
+
+private:
+    int _writes;
+};
+
+
+void benchWatcherFanOut () {
+    int const writes = iterations(100000);
+
+    for (int watcherCount : {0, 1, 16, 256}) {
+        FanOutThinker::Present present =
+            ThinkerQt::run<FanOutThinker>(writes);
+
+        QVector<FanOutThinker::PresentWatcher *> watchers;
+        for (int i = 0; i < watcherCount; i++)
+            watchers.append(new FanOutThinker::PresentWatcher (present));
+
+        present.postMessage(true);
+        present.waitForFinished();
+
+        report(
+            "watcher_fan_out",
+            "ns/write",
+            static_cast<double>(present.createSnapshot()->nsecs) / writes,
+            "watchers",
+            watcherCount
+        );
+
+        qDeleteAll(watchers);
+        QCoreApplication::processEvents();
+    }
+}
+
+} // end anonymous namespace
+
+
+
+int main (int argc, char * argv[])
+{
+    QCoreApplication app (argc, argv);
+
+    if (app.arguments().contains("--quick"))
+        iterationDivisor = 10;
+
+    benchClock.start();
+
+    benchRunToStart();
+    benchPollCost();
+    benchPauseResume();
+    benchCancel();
+    benchSnapshotContention();
+    benchThrottler();
+    benchWatcherFanOut();
+
+    return 0;
+}
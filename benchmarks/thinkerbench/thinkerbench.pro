@@ -0,0 +1,20 @@
+QT       += core
+QT       -= gui
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = thinkerbench
+TEMPLATE = app
+
+SOURCES       = main.cpp
+
+HEADERS       = ../common/benchcommon.h
+
+include(../../thinkerqt.pri)
+
+INCLUDEPATH += ../common
+
+# Timings are meaningless without optimization
+CONFIG   += release
+CONFIG   -= debug
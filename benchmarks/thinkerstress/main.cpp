@@ -0,0 +1,435 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector>
+#include <QtAlgorithms>
+#include <random>
+
+#include <sys/resource.h>
+
+#include "thinkerqt/thinker.h"
+#include "thinkerqt/thinkermanager.h"
+
+#include "benchcommon.h"
+
+//
+// thinkerstress
+//
+// A load generator that drives the manager through the public API with
+// the patterns we see at scale:
+//
+// * flood: tens of thousands of short thinkers queued at once, with a
+//   couple thousand watchers attached
+// * churn: a working set of live thinkers constantly canceled and
+//   relaunched, while reader threads snapshot long-running writers
+//
+// Results are JSON objects, one per line on stdout: latency percentiles,
+// throughput, the manager's lifecycle metrics, and process-wide peak RSS
+// and context switches.  Run with --help for the knobs.
+//
+// Contention on the manager's maps and mutexes isn't visible from outside,
+// so it shows up here as the spread between idle and loaded latencies of
+// calls that take them (cancel, createSnapshot), and as voluntary context
+// switches, which are mostly threads blocking on a lock.  --lock-profile
+// says which locks, per phase (see ThinkerLockProfile), at some cost.
+//
+
+namespace {
+
+QElapsedTimer stressClock; // started in main(), read from every thread
+
+
+struct Options {
+    int thinkers;
+    int watchers;
+    int workMicroseconds;
+    int churnSeconds;
+    int live;
+    int streams;
+    int readers;
+};
+
+
+void report (
+    char const * phase,
+    char const * metric,
+    char const * unit,
+    double value
+) {
+    BenchRecord ("phase", phase)
+        .text("metric", metric)
+        .text("unit", unit)
+        .real("value", value);
+}
+
+
+void report (
+    char const * phase,
+    char const * metric,
+    QVector<qint64> const & samples
+) {
+    if (samples.isEmpty())
+        return;
+
+    BenchRecord ("phase", phase).text("metric", metric).latencies(samples);
+}
+
+
+
+//
+// Thinkers
+//
+
+// Spins for a while, as a stand-in for real work, polling for pauses the
+// way a well-behaved thinker would
+
+class BusyThinker : public Thinker<CounterData>
+{
+public:
+    BusyThinker (qint64 workNsecs) :
+        Thinker (),
+        _workNsecs (workNsecs)
+    {
+    }
+
+protected:
+    bool start () override {
+        qint64 until = stressClock.nsecsElapsed() + _workNsecs;
+        while (stressClock.nsecsElapsed() < until) {
+            if (wasPauseRequested())
+                return false;
+        }
+
+        lockForWrite();
+        writable().counter++;
+        unlock();
+        return true;
+    }
+
+private:
+    qint64 _workNsecs;
+};
+
+
+//
+// Phases
+//
+
+void reportManagerMetrics (char const * phase) {
+    ThinkerMetricsTotals totals =
+        ThinkerManager::getGlobalManager().metricsTotals();
+    int count = totals.finishedCount + totals.canceledCount;
+    if (count == 0)
+        return;
+
+    report(phase, "finished", "thinkers", totals.finishedCount);
+    report(phase, "canceled", "thinkers", totals.canceledCount);
+    report(
+        phase, "queue_wait_mean", "ns",
+        static_cast<double>(totals.sum.queueWaitNsecs) / count
+    );
+    report(
+        phase, "thread_push_mean", "ns",
+        static_cast<double>(totals.sum.threadPushNsecs) / count
+    );
+
+    ThinkerManager::getGlobalManager().resetMetricsTotals();
+}
+
+
+void reportLocks (char const * phase) {
+    if (not ThinkerLockProfile::isEnabled())
+        return;
+
+    for (ThinkerLockStats const & stats : ThinkerLockProfile::report()) {
+        BenchRecord ("phase", phase)
+            .text("lock", stats.name)
+            .text("unit", "ns")
+            .integer("acquisitions", stats.acquisitions)
+            .integer("contended", stats.contended)
+            .integer("wait_total", stats.waitNsecs)
+            .integer("wait_p99", stats.waitHistogram.percentile(0.99))
+            .integer("wait_max", stats.waitHistogram.maximum())
+            .integer("hold_total", stats.holdNsecs)
+            .integer("hold_max", stats.maxHoldNsecs);
+    }
+
+    ThinkerLockProfile::reset();
+}
+
+
+void runFlood (Options const & options) {
+    qint64 const workNsecs = options.workMicroseconds * Q_INT64_C(1000);
+
+    QVector<BusyThinker::Present> presents;
+    presents.reserve(options.thinkers);
+    QVector<qint64> runLatencies;
+    runLatencies.reserve(options.thinkers);
+
+    qint64 startedAt = stressClock.nsecsElapsed();
+
+    for (int i = 0; i < options.thinkers; i++) {
+        qint64 then = stressClock.nsecsElapsed();
+        presents.append(ThinkerQt::run<BusyThinker>(workNsecs));
+        runLatencies.append(stressClock.nsecsElapsed() - then);
+    }
+
+    int finishedSignals = 0;
+    QVector<BusyThinker::PresentWatcher *> watchers;
+    for (int i = 0; i < qMin(options.watchers, presents.size()); i++) {
+        // Watch the ones at the back of the queue, which are still waiting
+        BusyThinker::PresentWatcher * watcher =
+            new BusyThinker::PresentWatcher (presents[presents.size() - 1 - i]);
+        QObject::connect(
+            watcher, &ThinkerPresentWatcherBase::finished,
+            [&finishedSignals] () { finishedSignals++; }
+        );
+        watchers.append(watcher);
+    }
+
+    // Statuses are atomic reads, so sweeping them doesn't perturb much
+    int next = 0;
+    while (next < presents.size()) {
+        if (presents[next].isFinished())
+            next++;
+        else
+            QCoreApplication::processEvents();
+    }
+    QCoreApplication::processEvents();
+
+    double seconds = (stressClock.nsecsElapsed() - startedAt) / 1e9;
+
+    report("flood", "run_latency", runLatencies);
+    report("flood", "throughput", "thinkers/s", options.thinkers / seconds);
+    report("flood", "watcher_finished_signals", "signals", finishedSignals);
+    reportManagerMetrics("flood");
+    reportLocks("flood");
+
+    qDeleteAll(watchers);
+    presents.clear();
+    QCoreApplication::processEvents();
+}
+
+
+QVector<qint64> snapshotLatencies (
+    QVector<WriterThinker::Present> const & streams,
+    int readers,
+    qint64 duration
+) {
+    qint64 until = stressClock.nsecsElapsed() + duration;
+
+    QVector<SnapshotReader *> threads;
+    for (int i = 0; i < readers; i++) {
+        threads.append(new SnapshotReader (
+            streams[i % streams.size()], stressClock, until, 16
+        ));
+        threads.last()->start();
+    }
+
+    // Keep thread pushes and deferred deletes moving while they read
+    while (stressClock.nsecsElapsed() < until)
+        QCoreApplication::processEvents();
+
+    QVector<qint64> samples;
+    for (SnapshotReader * thread : threads) {
+        thread->wait();
+        samples += thread->samples();
+    }
+    qDeleteAll(threads);
+    return samples;
+}
+
+
+void runChurn (Options const & options) {
+    std::mt19937 random (12345); // fixed, so runs are comparable
+    std::uniform_int_distribution<int> pickLive (0, options.live - 1);
+    std::uniform_int_distribution<qint64> pickWork (
+        Q_INT64_C(100000), Q_INT64_C(20000000) // 0.1ms to 20ms
+    );
+
+    QVector<WriterThinker::Present> streams;
+    for (int i = 0; i < options.streams; i++)
+        streams.append(ThinkerQt::run<WriterThinker>());
+    for (WriterThinker::Present & stream : streams) {
+        while (stream.version() == 0)
+            QCoreApplication::processEvents();
+    }
+
+    // A baseline with nothing else going on but the writers
+    report(
+        "idle",
+        "create_snapshot_latency",
+        snapshotLatencies(streams, options.readers, Q_INT64_C(1000000000))
+    );
+
+    QVector<BusyThinker::Present> live;
+    for (int i = 0; i < options.live; i++)
+        live.append(ThinkerQt::run<BusyThinker>(pickWork(random)));
+
+    QVector<BusyThinker::PresentWatcher *> watchers;
+    for (int i = 0; i < qMin(options.watchers, options.live); i++)
+        watchers.append(new BusyThinker::PresentWatcher (live[i]));
+
+    qint64 const duration = options.churnSeconds * Q_INT64_C(1000000000);
+    qint64 until = stressClock.nsecsElapsed() + duration;
+
+    QVector<SnapshotReader *> readers;
+    for (int i = 0; i < options.readers; i++) {
+        readers.append(new SnapshotReader (
+            streams[i % streams.size()], stressClock, until, 16
+        ));
+        readers.last()->start();
+    }
+
+    QVector<qint64> cancelLatencies;
+    QVector<qint64> relaunchLatencies;
+    int relaunches = 0;
+
+    while (stressClock.nsecsElapsed() < until) {
+        int index = pickLive(random);
+
+        qint64 then = stressClock.nsecsElapsed();
+        live[index].cancel();
+        qint64 canceled = stressClock.nsecsElapsed();
+        live[index] = ThinkerQt::run<BusyThinker>(pickWork(random));
+        qint64 relaunched = stressClock.nsecsElapsed();
+
+        cancelLatencies.append(canceled - then);
+        relaunchLatencies.append(relaunched - canceled);
+
+        if (index < watchers.size())
+            watchers[index]->setPresent(live[index]);
+
+        if (++relaunches % 64 == 0)
+            QCoreApplication::processEvents();
+    }
+
+    QVector<qint64> snapshotSamples;
+    for (SnapshotReader * reader : readers) {
+        reader->wait();
+        snapshotSamples += reader->samples();
+    }
+    qDeleteAll(readers);
+
+    report("churn", "cancel_latency", cancelLatencies);
+    report("churn", "relaunch_latency", relaunchLatencies);
+    report("churn", "create_snapshot_latency", snapshotSamples);
+    report(
+        "churn", "relaunch_throughput", "thinkers/s",
+        relaunches / (duration / 1e9)
+    );
+
+    qDeleteAll(watchers);
+    for (BusyThinker::Present & present : live)
+        present.cancel();
+    for (WriterThinker::Present & stream : streams)
+        stream.cancel();
+    for (BusyThinker::Present & present : live)
+        present.waitForFinished();
+    for (WriterThinker::Present & stream : streams)
+        stream.waitForFinished();
+    reportManagerMetrics("churn");
+    reportLocks("churn");
+}
+
+
+void reportProcess () {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return;
+
+    // ru_maxrss is in kilobytes on Linux
+    report("process", "peak_rss", "kB", usage.ru_maxrss);
+    report("process", "voluntary_context_switches", "switches", usage.ru_nvcsw);
+    report(
+        "process", "involuntary_context_switches", "switches", usage.ru_nivcsw
+    );
+}
+
+} // end anonymous namespace
+
+
+
+int main (int argc, char * argv[])
+{
+    QCoreApplication app (argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Thinker-Qt scale stress harness");
+    parser.addHelpOption();
+
+    QCommandLineOption thinkersOption (
+        "thinkers", "Thinkers queued at once in the flood phase.", "n", "50000"
+    );
+    QCommandLineOption watchersOption (
+        "watchers", "Watchers attached during each phase.", "n", "2000"
+    );
+    QCommandLineOption workOption (
+        "work-us", "Microseconds of work per flood thinker.", "n", "50"
+    );
+    QCommandLineOption churnOption (
+        "churn-seconds", "How long to cancel and relaunch.", "n", "10"
+    );
+    QCommandLineOption liveOption (
+        "live", "Thinkers kept alive during churn.", "n", "5000"
+    );
+    QCommandLineOption streamsOption (
+        "streams", "Constantly writing thinkers to snapshot.", "n", "2"
+    );
+    QCommandLineOption readersOption (
+        "readers", "Threads taking snapshots during churn.", "n", "4"
+    );
+    QCommandLineOption lockProfileOption (
+        "lock-profile", "Report waiting and holding per library lock."
+    );
+    parser.addOption(thinkersOption);
+    parser.addOption(watchersOption);
+    parser.addOption(workOption);
+    parser.addOption(churnOption);
+    parser.addOption(liveOption);
+    parser.addOption(streamsOption);
+    parser.addOption(readersOption);
+    parser.addOption(lockProfileOption);
+    parser.process(app);
+
+    Options options;
+    options.thinkers = parser.value(thinkersOption).toInt();
+    options.watchers = parser.value(watchersOption).toInt();
+    options.workMicroseconds = parser.value(workOption).toInt();
+    options.churnSeconds = parser.value(churnOption).toInt();
+    options.live = qMax(1, parser.value(liveOption).toInt());
+    options.streams = qMax(1, parser.value(streamsOption).toInt());
+    options.readers = parser.value(readersOption).toInt();
+
+    stressClock.start();
+    ThinkerManager::getGlobalManager().setMetricsEnabled(true);
+    ThinkerLockProfile::setEnabled(parser.isSet(lockProfileOption));
+
+    runFlood(options);
+    runChurn(options);
+    reportProcess();
+
+    return 0;
+}
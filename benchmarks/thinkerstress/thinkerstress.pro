@@ -0,0 +1,20 @@
+QT       += core
+QT       -= gui
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = thinkerstress
+TEMPLATE = app
+
+SOURCES       = main.cpp
+
+HEADERS       = ../common/benchcommon.h
+
+include(../../thinkerqt.pri)
+
+INCLUDEPATH += ../common
+
+# Latencies are meaningless without optimization
+CONFIG   += release
+CONFIG   -= debug
@@ -60,6 +60,9 @@ MandelbrotWidget::MandelbrotWidget(QWidget *parent)
     connect(&watcher, SIGNAL(written()), this, SLOT(updatePixmap()));
     watcher.setThrottleTime(400);
 
+    // panning back to a spot rendered a moment ago shouldn't render it again
+    ThinkerManager::getGlobalManager().setResultCacheBudget(64 * 1024 * 1024);
+
     setWindowTitle(tr("Mandelbrot"));
 #ifndef QT_NO_CURSOR
     setCursor(Qt::CrossCursor);
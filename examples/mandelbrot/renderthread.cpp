@@ -48,6 +48,20 @@ RenderThinker::RenderThinker(double centerX, double centerY, double scaleFactor,
 {
 }
 
+QByteArray RenderThinker::cacheKey() const
+{
+    // the colormap is filled in once by the widget and never changes
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << centerX << centerY << scaleFactor << resultSize;
+    return key;
+}
+
+int RenderThinker::cacheCost() const
+{
+    return resultSize.width() * resultSize.height() * 4;
+}
+
 bool RenderThinker::start()
 {
         int halfWidth = resultSize.width() / 2;
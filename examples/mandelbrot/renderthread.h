@@ -65,6 +65,10 @@ public:
     QImage const & getImage() const { return image; }
 
     double getScaleFactor() const { return scaleFactor; }
+
+    qint64 heapBytes() const override {
+        return static_cast<qint64>(image.bytesPerLine()) * image.height();
+    }
 };
 
 const int ColormapSize = 512;
@@ -81,6 +85,9 @@ public:
 protected:
     virtual void start() override;
 
+    virtual QByteArray cacheKey() const override;
+    virtual int cacheCost() const override;
+
 private:
     double centerX;
     double centerY;
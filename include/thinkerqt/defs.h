@@ -33,6 +33,29 @@ using std::shared_ptr;
 using std::unique_ptr;
 using std::make_shared;
 
+// Define THINKERQT_NO_CHECKS=1 in release builds to compile away the checks
+// that run on hot paths.  hopefully() becomes a macro that doesn't evaluate
+// its condition and gives true (tracked<> checks included), so conditions
+// must not have side effects.  The hopefullyXxxThreadXxx() affinity checks
+// --some of which take the manager's map mutex and search the thread map--
+// become inline "return true".  hopefullyNotReached() still aborts, as it
+// only runs when something has already gone wrong.  With THINKERQT_USE_HOIST,
+// hoist keeps its own behavior and only the thread checks are affected.
+//
+// Leave it undefined for debug builds, where the checks are all on.
+
+#ifndef THINKERQT_NO_CHECKS
+#define THINKERQT_NO_CHECKS 0
+#endif
+
+// Define THINKERQT_USDT=1 on Linux to build in the static tracepoints listed
+// in thinkerprobes.h, which perf and bpftrace can attach to in a running
+// process.  Needs <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel).
+
+#ifndef THINKERQT_USDT
+#define THINKERQT_USDT 0
+#endif
+
 #if THINKERQT_USE_HOIST
 
 // The hoist library is something that I use as an alternative system for
@@ -69,6 +69,24 @@ inline bool hopefullyNotReached(char const * message, codeplace const & cp)
 }
 
 
+#if THINKERQT_NO_CHECKS
+
+// A macro, so that the condition isn't even evaluated.  It is still compiled
+// (as the operand of sizeof), so checks don't rot in release builds, but it
+// must not have side effects that the code relies on.
+
+inline bool hopefullyUnchecked(size_t)
+{
+    return true;
+}
+
+#define hopefully(condition, cp) \
+    hopefullyUnchecked(sizeof( \
+        (static_cast<void>(cp), static_cast<bool>(condition)) \
+    ))
+
+#else
+
 inline bool hopefully(bool condition, codeplace const & cp)
 {
     if (not condition) {
@@ -78,6 +96,8 @@ inline bool hopefully(bool condition, codeplace const & cp)
     return true;
 }
 
+#endif
+
 
 inline bool hopefullyNotReached(codeplace const & cp)
 {
@@ -0,0 +1,119 @@
+//
+// latencyhistogram.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_LATENCYHISTOGRAM_H
+#define THINKERQT_LATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+#include <QtAlgorithms>
+
+#include "defs.h"
+
+//
+// LatencyHistogram
+//
+// Counts of durations in power-of-two buckets of nanoseconds: bucket i
+// holds durations below bucketCeiling(i) and at least half that.  That's
+// coarse, but recording is a couple of instructions and the shape (is it
+// all about 200ms, or a long tail?) is what matters for finding lag.
+// Percentiles are reported as the ceiling of the bucket they fall in.
+// Not thread-safe by itself; whoever owns one does the locking.
+//
+
+class LatencyHistogram
+{
+public:
+    enum {
+        BucketCount = 40 // the last collects everything from 4.6 minutes up
+    };
+
+public:
+    LatencyHistogram () :
+        _count (0),
+        _maximum (0)
+    {
+        for (int index = 0; index < BucketCount; index++)
+            _buckets[index] = 0;
+    }
+
+public:
+    static int bucketIndex (qint64 nsecs) {
+        int index = 0;
+        if (nsecs > 0) {
+            index = 64 - qCountLeadingZeroBits(static_cast<quint64>(nsecs));
+            index = qMin(index, static_cast<int>(BucketCount) - 1);
+        }
+        return index;
+    }
+
+    void record (qint64 nsecs) {
+        _buckets[bucketIndex(nsecs)]++;
+        _count++;
+        _maximum = qMax(_maximum, nsecs);
+    }
+
+    // For counts that were kept elsewhere, in atomics say
+    void add (quint64 const (&buckets)[BucketCount], qint64 maximum) {
+        for (int index = 0; index < BucketCount; index++) {
+            _buckets[index] += buckets[index];
+            _count += buckets[index];
+        }
+        _maximum = qMax(_maximum, maximum);
+    }
+
+    quint64 count () const {
+        return _count;
+    }
+
+    qint64 maximum () const {
+        return _maximum;
+    }
+
+    quint64 bucket (int index) const {
+        return _buckets[index];
+    }
+
+    static qint64 bucketCeiling (int index) {
+        return Q_INT64_C(1) << index;
+    }
+
+    // fraction is between 0 and 1, e.g. 0.99 for the 99th percentile
+    qint64 percentile (double fraction) const {
+        if (_count == 0)
+            return 0;
+
+        quint64 wanted = static_cast<quint64>(fraction * _count);
+        quint64 seen = 0;
+        for (int index = 0; index < BucketCount; index++) {
+            seen += _buckets[index];
+            if (seen > wanted)
+                return qMin(bucketCeiling(index), _maximum);
+        }
+        return _maximum;
+    }
+
+private:
+    quint64 _buckets[BucketCount];
+    quint64 _count;
+    qint64 _maximum;
+};
+
+#endif
@@ -0,0 +1,214 @@
+//
+// resultlog.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+
+#ifndef THINKERQT_RESULTLOG_H
+#define THINKERQT_RESULTLOG_H
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QtAlgorithms>
+#include <new>
+#include <climits>
+
+#include "defs.h"
+
+//
+// ResultLog
+//
+// An append-only list with one writer and any number of readers, which is
+// what a thinker producing a stream of results (search hits, tiles) needs.
+// Keeping a growing list in the thinker's data means each snapshot taken
+// after a write copies the whole list; here an item is written once and
+// never moved, so readers get references to it.
+//
+// Items live in chunks that double in size, and the chunk table has a fixed
+// length, so appending never relocates anything: it is amortized O(1) with
+// one allocation per chunk.  The writer publishes the count with a release
+// store after the item is in place, and readers only look at items below
+// the count they loaded, so neither side takes a lock.
+//
+// Readers each keep their own Cursor and consume at their own pace.  A
+// cursor is made from the slot the log will be published in, so it can be
+// created before the writer has appended (and allocated) anything.  It
+// also holds a reference to whatever owns the slot (for a thinker, the
+// thinker itself), so the slot and the log outlive the cursor.
+//
+
+class ResultLogBase
+{
+public:
+    virtual ~ResultLogBase ()
+    {
+    }
+
+public:
+    int count () const {
+        return _count.loadAcquire();
+    }
+
+protected:
+    ResultLogBase () :
+        _count (0)
+    {
+    }
+
+    // Chunk k holds FirstChunkSize << k items, enough chunks for any int
+    static const int FirstChunkSize = 64;
+    static const int MaxChunks = 26;
+
+    static size_t chunkSize (int chunk) {
+        return static_cast<size_t>(FirstChunkSize) << chunk;
+    }
+
+    static int chunkForIndex (int index, int & offset) {
+        // Chunk k starts at FirstChunkSize * (2^k - 1)
+        quint32 scaled = static_cast<quint32>(index / FirstChunkSize) + 1;
+        int chunk = 31 - static_cast<int>(qCountLeadingZeroBits(scaled));
+        offset = index - FirstChunkSize * ((1 << chunk) - 1);
+        return chunk;
+    }
+
+protected:
+    QAtomicInt _count;
+};
+
+
+template <class R>
+class ResultLog : public ResultLogBase
+{
+public:
+    ResultLog () :
+        ResultLogBase ()
+    {
+        for (int chunk = 0; chunk < MaxChunks; ++chunk)
+            _chunks[chunk] = nullptr;
+    }
+
+    ~ResultLog () override
+    {
+        int total = _count.loadAcquire();
+        for (int index = 0; index < total; ++index) {
+            int offset;
+            int chunk = chunkForIndex(index, offset);
+            _chunks[chunk][offset].~R();
+        }
+
+        for (int chunk = 0; chunk < MaxChunks; ++chunk)
+            ::operator delete(_chunks[chunk]);
+    }
+
+public:
+    // Writer only
+    void append (R const & item) {
+        int index = _count.loadAcquire();
+        hopefully(index < INT_MAX, HERE);
+
+        int offset;
+        int chunk = chunkForIndex(index, offset);
+        if (_chunks[chunk] == nullptr) {
+            _chunks[chunk] = static_cast<R *>(
+                ::operator new(sizeof(R) * chunkSize(chunk))
+            );
+        }
+
+        new (_chunks[chunk] + offset) R (item);
+
+        // Readers that see the new count see the item (and its chunk)
+        _count.storeRelease(index + 1);
+    }
+
+public:
+    R const & at (int index) const {
+        hopefully((index >= 0) and (index < count()), HERE);
+
+        int offset;
+        int chunk = chunkForIndex(index, offset);
+        return _chunks[chunk][offset];
+    }
+
+public:
+    class Cursor
+    {
+    public:
+        Cursor () :
+            _owner (),
+            _slot (nullptr),
+            _log (nullptr),
+            _position (0)
+        {
+        }
+
+        Cursor (
+            shared_ptr<void const> owner,
+            QAtomicPointer<ResultLogBase> const & slot,
+            int position = 0
+        ) :
+            _owner (owner),
+            _slot (&slot),
+            _log (nullptr),
+            _position (position)
+        {
+        }
+
+    public:
+        int position () const {
+            return _position;
+        }
+
+        int available () const {
+            ResultLog const * log = bind();
+            return log ? log->count() - _position : 0;
+        }
+
+        bool hasNext () const {
+            return available() > 0;
+        }
+
+        R const & next () {
+            hopefully(hasNext(), HERE);
+            return _log->at(_position++);
+        }
+
+    private:
+        ResultLog const * bind () const {
+            if ((_log == nullptr) and (_slot != nullptr)) {
+                ResultLogBase const * base = _slot->loadAcquire();
+                if (base != nullptr) {
+                    _log = dynamic_cast<ResultLog const *>(base);
+                    hopefully(_log != nullptr, HERE);
+                }
+            }
+            return _log;
+        }
+
+    private:
+        shared_ptr<void const> _owner; // keeps *_slot alive
+        QAtomicPointer<ResultLogBase> const * _slot;
+        mutable ResultLog const * _log; // found in _slot once published
+        int _position;
+    };
+
+private:
+    R * _chunks[MaxChunks];
+};
+
+#endif
@@ -25,9 +25,85 @@
 #include <QObject>
 #include <QSharedData>
 #include <QSharedDataPointer>
-#include <QReadWriteLock>
+#include <QAtomicInteger>
 
 #include "defs.h"
+#include "thinkertrace.h"
+#include "thinkerlockprofile.h"
+#include "thinkerprobes.h"
+
+//
+// Memory accounting
+//
+// A write made while Snapshots still share the data copies it, and the old
+// version then lives on for as long as the Snapshots do.  With a big
+// DataType that adds up quietly, so each Snapshottable counts the versions
+// it has left behind to Snapshots ("pinned") and their size.  Sizes are
+// sizeof(DataType) plus whatever SnapshottableData::heapBytes() reports.
+//
+
+struct SnapshottableMemoryUsage
+{
+    SnapshottableMemoryUsage () :
+        currentBytes (0),
+        pinnedVersions (0),
+        pinnedBytes (0),
+        bytesDetached (0)
+    {
+    }
+
+    qint64 currentBytes; // the data as it is now
+    int pinnedVersions; // older versions still held by Snapshots
+    qint64 pinnedBytes;
+    quint64 bytesDetached; // copied by writes, ever
+
+    SnapshottableMemoryUsage & operator+= (
+        SnapshottableMemoryUsage const & other
+    ) {
+        currentBytes += other.currentBytes;
+        pinnedVersions += other.pinnedVersions;
+        pinnedBytes += other.pinnedBytes;
+        bytesDetached += other.bytesDetached;
+        return *this;
+    }
+};
+
+
+// Shared by a Snapshottable and all versions of its data, which may outlive
+// it.  Pinning also counts toward the total, if there is one (thinkers
+// count toward their manager's).
+
+class SnapshotMemoryCounters
+{
+public:
+    SnapshotMemoryCounters () :
+        pinnedVersions (0),
+        pinnedBytes (0),
+        total ()
+    {
+    }
+
+public:
+    void pin (qint64 bytes) {
+        pinnedVersions.ref();
+        pinnedBytes.fetchAndAddOrdered(bytes);
+        if (total)
+            total->pin(bytes);
+    }
+
+    void unpin (qint64 bytes) {
+        pinnedVersions.deref();
+        pinnedBytes.fetchAndAddOrdered(-bytes);
+        if (total)
+            total->unpin(bytes);
+    }
+
+public:
+    QAtomicInt pinnedVersions;
+    QAtomicInteger<qint64> pinnedBytes;
+    shared_ptr<SnapshotMemoryCounters> total; // set before any writes
+};
+
 
 //
 // SnapshottableData
@@ -52,9 +128,41 @@
 class SnapshottableData : public QSharedData
 {
 public:
+    SnapshottableData () :
+        QSharedData (),
+        _memory (),
+        _pinnedBytes (0)
+    {
+    }
+
+    // A copy is the current version, whatever the original was
+    SnapshottableData (SnapshottableData const & other) :
+        QSharedData (other),
+        _memory (other._memory),
+        _pinnedBytes (0)
+    {
+    }
+
     virtual ~SnapshottableData ()
     {
+        if (_pinnedBytes != 0)
+            _memory->unpin(_pinnedBytes);
     }
+
+public:
+    // Override to count memory the data owns outside of its own object,
+    // such as what its containers hold, for memory accounting.  It is
+    // asked when a write copies the data, so should cost little next to
+    // the copy.
+    virtual qint64 heapBytes () const {
+        return 0;
+    }
+
+private:
+    template <class T> friend class Snapshottable;
+
+    shared_ptr<SnapshotMemoryCounters> _memory;
+    qint64 _pinnedBytes; // nonzero once left to Snapshots
 };
 
 
@@ -136,7 +244,30 @@ public:
     // Note: http://doc.trolltech.com/4.6/functions.html
     virtual SnapshotBase * createSnapshotBase() const = 0;
 
+public:
+    // Every unlock() publishes a new version of the data.  The counter is
+    // bumped while the write lock is still held, so a snapshot taken after
+    // reading version N will reflect at least that version.
+
+    quint64 version () const {
+        return _version.loadAcquire();
+    }
+
+    // Bytes copied because a write came while a snapshot still shared the
+    // data (see ThinkerMetrics::bytesDetached)
+    quint64 bytesDetached () const {
+        return _bytesDetached.loadAcquire();
+    }
+
+    // Takes the read lock to measure the current data, so not on a thread
+    // that holds the write lock
+    virtual SnapshottableMemoryUsage memoryUsage () const = 0;
+
 protected:
+    // Makes the data that of a snapshot taken from another Snapshottable of
+    // the same type, as one more version.  The data is shared, not copied.
+    virtual void adoptSnapshotBase (SnapshotBase const & snapshot) = 0;
+
         // It's true that the shared data pointer protects us across threads
         // so we make copies safely.  But sometimes we have several
         // writes that go together and we don't want anyone to snapshot
@@ -146,8 +277,11 @@ protected:
     virtual void unlock (codeplace const & cp);
 
 protected:
-    mutable QReadWriteLock _dLock;
+    mutable ThinkerReadWriteLock _dLock;
     tracked<bool> _lockedForWrite;
+    QAtomicInteger<quint64> _version;
+    QAtomicInteger<quint64> _bytesDetached;
+    shared_ptr<SnapshotMemoryCounters> _memory;
 };
 
 
@@ -251,6 +385,7 @@ public:
             new DataType (std::forward<Args>(args)...))
         )
     {
+        accountingOf(*_d.constData())._memory = _memory;
     }
 
     virtual ~Snapshottable () override
@@ -260,7 +395,12 @@ public:
 
 public:
     Snapshot createSnapshot () const {
-        QReadLocker lock (&this->_dLock);
+        ThinkerTrace::instant("snapshot");
+        THINKERQT_PROBE(
+            snapshot, static_cast<SnapshottableBase const *>(this)
+        );
+
+        ThinkerReadLocker lock (&this->_dLock);
         Snapshot result (_d);
         return result;
     }
@@ -269,6 +409,28 @@ public:
         return new Snapshot (createSnapshot());
     }
 
+protected:
+    virtual void adoptSnapshotBase (SnapshotBase const & snapshot) override {
+        Snapshot const & other = dynamic_cast<Snapshot const &>(snapshot);
+
+        this->_dLock.lockForWrite();
+        _d = other._d;
+        this->_version.fetchAndAddOrdered(1);
+        this->_dLock.unlock();
+    }
+
+public:
+    virtual SnapshottableMemoryUsage memoryUsage () const override {
+        SnapshottableMemoryUsage usage;
+
+        ThinkerReadLocker lock (&this->_dLock);
+        usage.currentBytes = bytesOf(*_d.constData());
+        usage.pinnedVersions = this->_memory->pinnedVersions.loadAcquire();
+        usage.pinnedBytes = this->_memory->pinnedBytes.loadAcquire();
+        usage.bytesDetached = this->bytesDetached();
+        return usage;
+    }
+
 
 protected:
     // Due to the copy-on-write nature of Snapshottable objects,
@@ -291,10 +453,41 @@ protected:
     DataType & writable (codeplace const & cp)
     {
         _lockedForWrite.hopefullyEqualTo(true, cp);
+
+        if (_d.constData()->ref.loadAcquire() != 1) {
+            // A snapshot holds the data, so it is copied.  We keep a
+            // reference to the old version while we count it as pinned,
+            // in case the snapshots all let go of it meanwhile.
+            QSharedDataPointer<DataType> previous (_d);
+            _d.detach();
+
+            // A DataType copy constructor may not copy the base class
+            accountingOf(*_d.constData())._memory = this->_memory;
+
+            qint64 bytes = bytesOf(*previous.constData());
+            accountingOf(*previous.constData())._pinnedBytes = bytes;
+            this->_memory->pin(bytes);
+            this->_bytesDetached.fetchAndAddRelaxed(bytes);
+        }
+
         return *_d;
     }
 
 
+private:
+    static qint64 bytesOf (DataType const & data) {
+        return static_cast<qint64>(sizeof(DataType)) + data.heapBytes();
+    }
+
+    // Only touches the accounting members, which aren't part of what a
+    // Snapshot guarantees won't change
+    static SnapshottableData & accountingOf (DataType const & data) {
+        return const_cast<SnapshottableData &>(
+            static_cast<SnapshottableData const &>(data)
+        );
+    }
+
+
 private:
     // you must initialize this "d" variable in your constructor, and
     // it is where you must put all of your state that you want to
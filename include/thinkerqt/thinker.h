@@ -23,18 +23,35 @@
 #define THINKERQT_THINKER_H
 
 #include <QObject>
-#include <QSet>
-#include <QReadWriteLock>
+#include <QVector>
+#include <QMap>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QWaitCondition>
+#include <QByteArray>
+#include <QString>
+#include <functional>
+#include <climits>
 
 #include "defs.h"
 #include "snapshottable.h"
 #include "signalthrottler.h"
 #include "thinkerpresent.h"
 #include "thinkerpresentwatcher.h"
+#include "thinkerlistener.h"
+#include "resultlog.h"
+#include "thinkerinbox.h"
+#include "thinkermetrics.h"
+#include "thinkerlockprofile.h"
 
 class ThinkerManager;
 class ThinkerRunner;
 class ThinkerPresentWatcherBase;
+class ThinkerEventNotifier;
+class ThinkerGroupWatcher;
+class ThinkerContinuation;
+class ThinkerCompletionQueue;
 
 //
 // ThinkerBase
@@ -59,6 +76,11 @@ class ThinkerBase : public QObject, virtual public SnapshottableBase {
     friend class ThinkerPresentWatcherBase;
     friend class ThinkerPresentBase;
     friend class ThinkerRunner;
+    friend class ThinkerEventNotifier;
+    friend class ThinkerGroupWatcher;
+    friend class ThinkerContinuation;
+    friend class ThinkerRetirementWait;
+    friend class ThinkerCompletionQueue;
 
 
 private:
@@ -106,7 +128,12 @@ public:
         // on the manager thread between the time the
         // Snapshot base class constructor has run
         // and when it is attached to a ThinkerPresent
+#if THINKERQT_NO_CHECKS
+        Q_UNUSED(cp);
+        return true;
+#else
         return hopefully(thread() == QThread::currentThread(), cp);
+#endif
     }
 
 
@@ -160,6 +187,172 @@ private:
         return false;
     }
 
+protected:
+    // Opt in to having the manager pause this thinker once every watcher
+    // that was looking at it has detached or been marked inactive for the
+    // grace period, and resume it when one becomes active again.  A thinker
+    // that was never watched is left alone.  Pausing or resuming it through
+    // a Present takes the pause out of the manager's hands.  Only thinkers
+    // that implement resume() should do this.  Call it from the constructor.
+
+    void setAutoPauseWhenUnwatched (bool autoPause);
+
+
+protected:
+    // A thinker started as a continuation (see ThinkerManager::then,
+    // whenAll and whenAny) gets the final snapshots of its inputs, in the
+    // order they were given.  They are in place before start() is called.
+    // For whenAny, inputs that had not finished when it launched (or that
+    // were canceled) have no snapshot.
+
+    int inputCount () const {
+        return _inputs.size();
+    }
+
+    SnapshotBase const * inputSnapshotBase (int index) const {
+        return _inputs[index].get();
+    }
+
+    template <class ThinkerType>
+    typename ThinkerType::Snapshot inputSnapshot (int index) const {
+        typedef typename ThinkerType::Snapshot Snapshot;
+
+        SnapshotBase const * base = inputSnapshotBase(index);
+        if (base == nullptr)
+            return Snapshot ();
+
+        Snapshot const * ptr = dynamic_cast<Snapshot const *>(base);
+        hopefully(ptr != nullptr, HERE);
+        return *ptr;
+    }
+
+
+protected:
+    // Streaming inputs.  Where a continuation waits for its inputs to finish,
+    // a thinker may instead declare live upstream thinkers (from its
+    // constructor) and refine its own result as they refine theirs.
+    // waitForUpstreamWritten() blocks the thinker until some upstream has
+    // written since the last call.  It returns false instead if a pause or
+    // cancel is requested, if the time runs out, or if every upstream has
+    // retired with nothing new.  Any number of writes made while the
+    // thinker was busy collapse into one wakeup, and upstreamSnapshot()
+    // always gives the latest state.  The first call doesn't wait, so the
+    // upstreams' initial state gets looked at too.
+
+    void addUpstream (ThinkerPresentBase upstream);
+
+    int upstreamCount () const {
+        return _upstreams.size();
+    }
+
+    bool waitForUpstreamWritten (unsigned long time = ULONG_MAX);
+
+    template <class ThinkerType>
+    typename ThinkerType::Snapshot upstreamSnapshot (int index) const {
+        typedef typename ThinkerType::Snapshot Snapshot;
+
+        unique_ptr<SnapshotBase> base (_upstreams[index].createSnapshotBase());
+        Snapshot const * ptr = dynamic_cast<Snapshot const *>(base.get());
+        hopefully(ptr != nullptr, HERE);
+        return *ptr;
+    }
+
+
+protected:
+    // Progress goes through its own channel instead of the snapshotted data,
+    // so reporting it takes no write lock, causes no copy-on-write of a data
+    // block someone holds a snapshot of, and doesn't count as a write.  The
+    // numbers are atomics that Presents read directly; only the text takes
+    // a (short) lock.  Listeners hear of it through thinkerProgressed(), and
+    // watchers emit a separately throttled progressChanged() signal.  Only
+    // call these from the thinker's own thread.
+
+    void setProgressRange (int minimum, int maximum);
+
+    void setProgressValue (int value);
+
+    void setProgressValueAndText (int value, QString const & text);
+
+
+private:
+    void notifyListenersProgressed ();
+
+
+protected:
+    // Thinkers that produce a stream of items (search hits, tiles) can report
+    // them one at a time instead of growing a list in their data, which each
+    // snapshot after a write would copy.  The items go in an append-only log
+    // that Presents read by reference with their own cursors.  Every result
+    // a thinker reports must be of the same type.  Listeners are told with
+    // thinkerResultsReported(), and watchers emit a throttled
+    // resultsReported() signal.
+
+    template <class R>
+    void reportResult (R const & result) {
+        hopefullyCurrentThreadIsThink(HERE);
+
+        // Only the thinker ever stores here, so there's no creation race
+        ResultLogBase * base = _results.loadAcquire();
+        if (base == nullptr) {
+            base = new ResultLog<R> ();
+            _results.storeRelease(base);
+        }
+
+        ResultLog<R> * log = dynamic_cast<ResultLog<R> *>(base);
+        hopefully(log != nullptr, HERE);
+        log->append(result);
+
+        notifyListenersResultsReported();
+    }
+
+
+private:
+    void notifyListenersResultsReported ();
+
+
+protected:
+    // Take the next message posted with ThinkerPresent::postMessage, if any.
+    // Call it where you'd poll wasPauseRequested(); a timed wait there ends
+    // early when a message arrives.  Messages come out in the order each
+    // poster sent them, though posts from different threads interleave.
+
+    template <class M>
+    bool takeMessage (M & message) {
+        hopefullyCurrentThreadIsThink(HERE);
+
+        if (_inbox.loadAcquire() == nullptr)
+            return false;
+
+        return ThinkerInbox<M>::ensure(_inbox)->take(message);
+    }
+
+    bool hasMessages () const;
+
+private:
+    // Unlike hasMessages(), false while the only messages are still being
+    // linked in by their posters, when takeMessage() wouldn't find them
+
+    bool hasReadyMessage () const;
+
+
+protected:
+    // Opt in to the manager's result cache (see setResultCacheBudget) by
+    // returning a key for everything the final result depends on, which is
+    // usually just the constructor arguments.  Thinkers of the same type
+    // with equal keys are taken to produce equal results.  Only the final
+    // data is kept, so a thinker whose results matter beyond its data (see
+    // reportResult) shouldn't opt in.  cacheCost() is roughly how many bytes
+    // the finished thinker's data takes up.  The default is the data's
+    // currentBytes (see SnapshottableMemoryUsage), so override heapBytes()
+    // on the data, or this, if it owns more than that.
+
+    virtual QByteArray cacheKey () const {
+        return QByteArray ();
+    }
+
+    virtual int cacheCost () const;
+
+
 protected:
     virtual bool start () = 0;
 
@@ -174,11 +367,169 @@ protected:
     }
 
 
+private:
+    // The runner mirrors its state here after every change, so a Present
+    // can answer isFinished(), isCanceled() and isPaused() with one atomic
+    // load instead of finding the runner under the maps mutex and locking
+    // it.  Written with the runner's _stateMutex held, or by the manager
+    // for a thinker that has no runner.
+
+    enum StatusFlag {
+        StatusPaused = 0x1,
+        StatusCanceled = 0x2,
+        StatusFinished = 0x4
+    };
+
+    void setCanceledWithoutRunner () {
+        _state = State::ThinkerCanceled;
+        _status.storeRelease(StatusCanceled | StatusFinished);
+    }
+
+    // For a thinker that will never run because the manager's result cache
+    // had the final snapshot of an equal one.  It takes on that data and is
+    // finished (and retired) from the start.
+    void setFinishedFromCache (SnapshotBase const & snapshot);
+
+
+private:
+    // Threads without an event loop can't use a PresentWatcher, so they
+    // block on _versionWasPublished instead.  Publishing only takes the
+    // mutex if someone has registered in _versionWaiters, so a thinker
+    // nobody is waiting on pays an atomic load per unlock().
+
+    bool waitForVersionAfter (quint64 version, unsigned long time);
+
+    void publishVersion ();
+
+    // Called by the manager once the runner is done with the thinker.
+    // Releases version waiters and tells the listeners.
+
+    void retire (bool wasCanceled);
+
+    // One-shot callbacks run after the listeners are told of retirement, on
+    // the same thread.  If the thinker already retired the callback is run
+    // right away, on the caller's thread, and the token is zero.  Removing a
+    // callback that retirement has already taken does nothing, so it may
+    // still run (or be running) after removeRetiredCallback() returns.
+
+    quint64 whenRetired (std::function<void (bool wasCanceled)> callback);
+
+    void removeRetiredCallback (quint64 token);
+
+    bool isRetired () const {
+        return _retired.loadAcquire() != 0;
+    }
+
+
+private:
+    // The listener list is read by the thinker's thread on every unlock(),
+    // but only changes when a watcher attaches or detaches.  So instead of
+    // locking it on each read, the list is an immutable array which writers
+    // replace wholesale.  Readers announce themselves in one of two reader
+    // counts before loading the pointer.  A writer who swapped out the old
+    // array points new readers at the other count, and waits only for the
+    // one it retired to drain before freeing the array.
+
+    typedef QVector<ThinkerListener *> ListenerList;
+
+    void attachListener (ThinkerListener & listener);
+
+    void detachListener (ThinkerListener & listener);
+
+    void replaceListeners (ListenerList const * newListeners);
+
+    int enterListeners ();
+
+    void leaveListeners (int generation);
+
+    void notifyListenersWritten ();
+
+
+private:
+    // One listener is attached to all the upstreams, the first time the
+    // thinker waits on them.  It nudges our runner when any of them writes
+    // or retires.
+
+    class UpstreamListener;
+
+
+private:
+    // Watchers report whether anyone is actually looking at the thinker.
+    // Only transitions to and from zero are forwarded to the manager, and
+    // only for thinkers that opted in.
+
+    void watcherActivated ();
+
+    void watcherDeactivated ();
+
+
+private:
+    // Every Present handed out for this thinker is counted, so the manager
+    // can tell when the last one is dropped (see setCancelOrphanedThinkers).
+
+    void presentAcquired ();
+
+    void presentReleased ();
+
+
+private:
+    // A keyed thinker may be handed out by several run() calls while it is
+    // in flight (see ThinkerManager::setResultCacheBudget), and each of those
+    // is a sharer.
+    // Once the count reaches zero the thinker is being canceled, and no one
+    // else may join.
+
+    bool tryJoinSharers ();
+
+    bool leaveSharers ();
+
+
 private:
     State _state;
+    QAtomicInt _status;
     ThinkerManager & _mgr;
-    QReadWriteLock _watchersLock;
-    QSet<ThinkerPresentWatcherBase *> _watchers;
+    ThinkerMutex _listenersMutex; // only serializes attach/detach/retire
+    QAtomicPointer<ListenerList const> _listeners;
+    QAtomicInt _listenersGeneration; // which of the reader counts is live
+    QAtomicInt _listenersReaders[2];
+    bool _listenersRetired; // guarded by _listenersMutex
+    QMap<quint64, std::function<void (bool)>> _retiredCallbacks; // same
+    quint64 _lastRetiredToken; // same
+    QAtomicInt _retired;
+
+    QVector<shared_ptr<SnapshotBase>> _inputs;
+
+    QByteArray _cacheKey; // set by the manager before the thinker runs
+
+    QVector<ThinkerPresentBase> _upstreams; // set during construction only
+    QVector<quint64> _upstreamVersionsSeen; // thinker thread only
+    unique_ptr<UpstreamListener> _upstreamListener; // same
+    QAtomicInt _upstreamsRetired;
+
+    QAtomicInt _versionWaiters;
+    ThinkerMutex _versionMutex;
+    QWaitCondition _versionWasPublished;
+    bool _versionsRetired; // guarded by _versionMutex
+
+    QAtomicInt _activeWatchers;
+    bool _autoPauseWhenUnwatched; // set during construction only
+    int _demandGeneration; // manager thread only
+
+    QAtomicInt _presentCount;
+    QAtomicInt _sharers;
+
+    QAtomicInt _progressMinimum;
+    QAtomicInt _progressMaximum;
+    QAtomicInt _progressValue;
+    mutable QMutex _progressTextMutex;
+    QString _progressText; // guarded by _progressTextMutex
+
+    QAtomicPointer<ResultLogBase> _results; // made on the first report
+    QAtomicPointer<ThinkerInboxBase> _inbox; // made on first post or take
+    mutable QAtomicInt _waitingForMessages; // in wasPauseRequested(time)
+
+    mutable QMutex _metricsMutex;
+    ThinkerMetrics _metrics; // written by the runner, guarded by the mutex
 };
 
 
@@ -411,6 +762,45 @@ namespace ThinkerQt {
             new ThinkerType (std::forward<Args>(args)...))
         );
     }
+
+    template <class ThinkerType, class... Args>
+    typename ThinkerType::Present then (
+        ThinkerPresentBase input,
+        Args&&... args
+    ) {
+        return ThinkerManager::getGlobalManager().then(
+            input,
+            unique_ptr<ThinkerType>(
+                new ThinkerType (std::forward<Args>(args)...)
+            )
+        );
+    }
+
+    template <class ThinkerType, class... Args>
+    typename ThinkerType::Present whenAll (
+        QVector<ThinkerPresentBase> inputs,
+        Args&&... args
+    ) {
+        return ThinkerManager::getGlobalManager().whenAll(
+            inputs,
+            unique_ptr<ThinkerType>(
+                new ThinkerType (std::forward<Args>(args)...)
+            )
+        );
+    }
+
+    template <class ThinkerType, class... Args>
+    typename ThinkerType::Present whenAny (
+        QVector<ThinkerPresentBase> inputs,
+        Args&&... args
+    ) {
+        return ThinkerManager::getGlobalManager().whenAny(
+            inputs,
+            unique_ptr<ThinkerType>(
+                new ThinkerType (std::forward<Args>(args)...)
+            )
+        );
+    }
 }
 #endif
 
@@ -0,0 +1,92 @@
+//
+// thinkercompletionqueue.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+
+#ifndef THINKERQT_THINKERCOMPLETIONQUEUE_H
+#define THINKERQT_THINKERCOMPLETIONQUEUE_H
+
+#include <QThread>
+#include <QHash>
+#include <climits>
+
+#include "defs.h"
+#include "thinkerpresent.h"
+
+class ThinkerBase;
+class ThinkerManager;
+
+//
+// ThinkerCompletionQueue
+//
+// Waiting on a Present blocks on that one runner.  A coordinator that has
+// launched hundreds of thinkers and wants to deal with each as it completes
+// would have to poll them all, or set up a watcher per thinker.  Instead,
+// add the Presents to a completion queue and call takeRetired() in a loop:
+// each call hands back the next thinker to finish or be canceled, in the
+// order they did so.
+//
+// Retiring thinkers append themselves to a list behind one mutex and wake
+// one condition, so taking from the queue costs the same no matter how many
+// thinkers are still pending.
+//
+// The queue and the Presents it hands back belong to the thread that created
+// it.  That must not be the manager thread, which has to stay free to hand
+// thinkers over to their pool threads while we are blocked.
+//
+
+class ThinkerCompletionQueue
+{
+public:
+    ThinkerCompletionQueue ();
+
+    ~ThinkerCompletionQueue ();
+
+
+public:
+    void addPresent (ThinkerPresentBase present);
+
+    // Presents added but not yet handed back by takeRetired()
+    int pendingCount () const {
+        return _pending.size();
+    }
+
+    // Returns a null Present if nothing is pending, or if the time (in
+    // milliseconds) runs out before anything retires.
+    ThinkerPresentBase takeRetired (unsigned long time = ULONG_MAX);
+
+
+private:
+    class Retired;
+
+    struct Pending {
+        ThinkerPresentBase present;
+        quint64 token; // of the retirement callback, to remove it
+    };
+
+
+private:
+    QThread * _thread;
+    ThinkerManager * _mgr; // taken from the first Present added
+    QHash<ThinkerBase const *, Pending> _pending;
+    shared_ptr<Retired> _retired; // shared with the retirement callbacks
+};
+
+#endif
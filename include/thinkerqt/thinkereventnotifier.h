@@ -0,0 +1,98 @@
+//
+// thinkereventnotifier.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKEREVENTNOTIFIER_H
+#define THINKERQT_THINKEREVENTNOTIFIER_H
+
+#include <QtGlobal>
+
+#ifdef Q_OS_LINUX
+
+#include <QVector>
+#include <QAtomicInt>
+
+#include "defs.h"
+#include "thinkerpresent.h"
+#include "thinkerlistener.h"
+
+//
+// ThinkerEventNotifier
+//
+// Bridges thinker notifications into an event loop that isn't Qt's, such as
+// one built on epoll.  The notifier owns a Linux eventfd which becomes
+// readable when any of the Presents added to it is written to or retires.
+// Hand fileDescriptor() to your poller, and when it reports the descriptor
+// as readable call acknowledge() and then go look at your Presents.
+//
+// Writes are coalesced: after the descriptor is signaled, further publishes
+// won't touch it again until you acknowledge().  So no matter how many times
+// the thinkers unlock, it costs one write() and one wakeup per round trip.
+// Because acknowledge() re-arms *before* you go take your snapshots, any
+// publish that happens while you're looking will signal again.
+//
+// Like a Present, the notifier belongs to the thread that created it.  Only
+// add and remove Presents from that thread.
+//
+
+class ThinkerEventNotifier : private ThinkerListener
+{
+public:
+    ThinkerEventNotifier ();
+
+    ThinkerEventNotifier (ThinkerPresentBase present);
+
+    ThinkerEventNotifier (ThinkerEventNotifier const & other) = delete;
+
+    ~ThinkerEventNotifier () override;
+
+
+public:
+    int fileDescriptor () const {
+        return _fd;
+    }
+
+    void addPresent (ThinkerPresentBase present);
+
+    void removePresent (ThinkerPresentBase present);
+
+    // Drains the eventfd counter and re-arms the notifier.  Returns false if
+    // there was nothing to drain (e.g. a wakeup that was already handled).
+
+    bool acknowledge ();
+
+
+private:
+    void thinkerWritten () override;
+
+    void thinkerRetired (bool wasCanceled) override;
+
+    void signal ();
+
+
+private:
+    int _fd;
+    QAtomicInt _signaled; // set once the fd is written, until acknowledged
+    QVector<ThinkerPresentBase> _presents;
+};
+
+#endif
+
+#endif
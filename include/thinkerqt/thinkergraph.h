@@ -0,0 +1,97 @@
+//
+// thinkergraph.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+
+#ifndef THINKERQT_THINKERGRAPH_H
+#define THINKERQT_THINKERGRAPH_H
+
+#include <QVector>
+
+#include "defs.h"
+#include "thinkerpresent.h"
+
+class ThinkerManager;
+class ThinkerRunner;
+
+//
+// ThinkerGraph
+//
+// A streaming pipeline (see ThinkerBase::addUpstream) is several thinkers
+// that only make sense together.  Pausing a filter while the render feeding
+// it keeps running wastes the render's work, and canceling one stage leaves
+// the others refining for nobody.  The graph gathers the Presents of all the
+// stages so that they can be paused, resumed and canceled as a unit.
+//
+// Pausing requests the pause from every stage before waiting on any of them,
+// so the stages come to a stop together rather than one after another.
+//
+// Like the manager's ensureThinkersPaused(), this is driven from the manager
+// thread.
+//
+
+class ThinkerGraph
+{
+public:
+    ThinkerGraph ();
+
+    ~ThinkerGraph ();
+
+
+public:
+    void addPresent (ThinkerPresentBase present);
+
+    QVector<ThinkerPresentBase> presents () const {
+        return _presents;
+    }
+
+
+public:
+    void pause ();
+
+    void resume ();
+
+    void cancel ();
+
+    void waitForFinished ();
+
+
+public:
+    // Finished means every stage finished or was canceled; canceled means
+    // at least one of them was.
+
+    bool isFinished () const;
+
+    bool isCanceled () const;
+
+    bool isPaused () const;
+
+
+private:
+    ThinkerManager & getManager () const;
+
+    QVector<shared_ptr<ThinkerRunner>> getRunners () const;
+
+
+private:
+    QVector<ThinkerPresentBase> _presents;
+};
+
+#endif
@@ -0,0 +1,118 @@
+//
+// thinkergroupwatcher.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERGROUPWATCHER_H
+#define THINKERQT_THINKERGROUPWATCHER_H
+
+#include <QObject>
+#include <QMutex>
+#include <QHash>
+#include <QVector>
+
+#include "defs.h"
+#include "thinkerpresent.h"
+#include "signalthrottler.h"
+
+class ThinkerBase;
+
+//
+// ThinkerGroupWatcher
+//
+// A ThinkerPresentWatcher is a QObject with its own throttler and signal
+// connections, which adds up when a view is showing hundreds of thinkers
+// (tiles of an image, for instance).  The group watcher observes any number
+// of Presents with one throttler, and emits a single changed() signal that
+// says which of them were written (and which finished) since the last one.
+// That way one repaint can handle all of them.
+//
+// Members are tracked with a small non-QObject listener each.  The first
+// write to a member after an emit queues it for the next one; later writes
+// in the same interval just find it already queued.
+//
+// Like the PresentWatcher, the group watcher and its Presents belong to the
+// thread that created them, and changed() is emitted on that thread.  If you
+// want to connect it across threads you will need to register
+// QVector<ThinkerPresentBase> with qRegisterMetaType().
+//
+
+class ThinkerGroupWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    ThinkerGroupWatcher (QObject * parent = nullptr);
+
+    ~ThinkerGroupWatcher () override;
+
+
+signals:
+    void changed (
+        QVector<ThinkerPresentBase> written,
+        QVector<ThinkerPresentBase> finished
+    );
+
+
+public:
+    void setThrottleTime (unsigned int milliseconds);
+
+    void addPresent (ThinkerPresentBase present);
+
+    void removePresent (ThinkerPresentBase present);
+
+    bool containsPresent (ThinkerPresentBase const & present) const;
+
+    QVector<ThinkerPresentBase> presents () const;
+
+    void clear ();
+
+
+public:
+    // As with ThinkerPresentWatcher::setActive(), an inactive group doesn't
+    // count as watching its members for the purposes of auto-pausing.
+
+    void setActive (bool active);
+
+    bool isActive () const {
+        return _active;
+    }
+
+
+private slots:
+    void onThrottled ();
+
+
+private:
+    class Member;
+    friend class Member;
+
+    void schedule (Member & member);
+
+
+private:
+    SignalThrottler _throttler; // no parent, so emitThrottled is thread-safe
+    bool _active;
+    QHash<ThinkerBase const *, Member *> _members;
+
+    QMutex _pendingMutex;
+    QVector<Member *> _pending; // members with flags set, in arrival order
+};
+
+#endif
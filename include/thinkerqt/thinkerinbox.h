@@ -0,0 +1,206 @@
+//
+// thinkerinbox.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+
+#ifndef THINKERQT_THINKERINBOX_H
+#define THINKERQT_THINKERINBOX_H
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+
+#include "defs.h"
+
+//
+// ThinkerInbox
+//
+// Changing what a thinker works on used to mean canceling it and starting
+// another, losing whatever it had built up.  Instead, other threads can post
+// messages to a running thinker (ThinkerPresent::postMessage), which takes
+// them at the points where it polls for pause requests.  A thinker sleeping
+// in wasPauseRequested(time) is woken when one arrives.
+//
+// The inbox is a lock-free queue with many producers and one consumer (the
+// thinker), in the style of Dmitry Vyukov's intrusive MPSC queue.  Posting
+// is one exchange plus a store, whatever the contention.  The inbox is made
+// by whichever side touches it first, and all messages to one thinker must
+// be of the same type.
+//
+
+class ThinkerInboxBase
+{
+public:
+    virtual ~ThinkerInboxBase ()
+    {
+    }
+
+public:
+    // Posted but not yet taken.  Counted before the message is linked in,
+    // so it never goes below zero, and a nonzero count means take() will
+    // find something once its poster is done.
+    int pendingCount () const {
+        return _pending.loadAcquire();
+    }
+
+    // Consumer only.  Whether take() would find a message right now, rather
+    // than one its poster is still linking in.
+    virtual bool isReady () const = 0;
+
+protected:
+    ThinkerInboxBase () :
+        _pending (0)
+    {
+    }
+
+protected:
+    QAtomicInt _pending;
+};
+
+
+template <class M>
+class ThinkerInbox : public ThinkerInboxBase
+{
+private:
+    struct Link {
+        QAtomicPointer<Link> next;
+    };
+
+    struct Node : public Link {
+        explicit Node (M const & message) :
+            message (message)
+        {
+        }
+
+        M message;
+    };
+
+public:
+    ThinkerInbox () :
+        ThinkerInboxBase (),
+        _head (&_stub),
+        _tail (&_stub),
+        _stub ()
+    {
+        _stub.next.storeRelease(nullptr);
+    }
+
+    ~ThinkerInbox () override
+    {
+        // Nobody can be posting by now, so the list is fully linked
+        Link * link = _tail;
+        while (link != nullptr) {
+            Link * next = link->next.loadAcquire();
+            if (link != &_stub)
+                delete static_cast<Node *>(link);
+            link = next;
+        }
+    }
+
+public:
+    // Find the inbox in a thinker's slot, making it if this is the first
+    // use.  If two threads race to make it, one of them throws its away.
+    static ThinkerInbox * ensure (QAtomicPointer<ThinkerInboxBase> & slot) {
+        ThinkerInboxBase * base = slot.loadAcquire();
+        if (base == nullptr) {
+            ThinkerInbox * created = new ThinkerInbox ();
+            if (slot.testAndSetOrdered(nullptr, created)) {
+                base = created;
+            } else {
+                delete created;
+                base = slot.loadAcquire();
+            }
+        }
+
+        ThinkerInbox * inbox = dynamic_cast<ThinkerInbox *>(base);
+        hopefully(inbox != nullptr, HERE);
+        return inbox;
+    }
+
+public:
+    // Any thread
+    void post (M const & message) {
+        _pending.ref();
+        push(new Node (message));
+    }
+
+    bool isReady () const override {
+        Link * tail = _tail;
+        Link * next = tail->next.loadAcquire();
+
+        if (tail == &_stub) {
+            if (next == nullptr)
+                return false;
+            tail = next;
+            next = next->next.loadAcquire();
+        }
+
+        return (next != nullptr) or (tail == _head.loadAcquire());
+    }
+
+    // Consumer only.  May miss a message whose producer is halfway through
+    // posting it, in which case pendingCount() says to come back shortly.
+    bool take (M & message) {
+        Link * tail = _tail;
+        Link * next = tail->next.loadAcquire();
+
+        if (tail == &_stub) {
+            if (next == nullptr)
+                return false;
+            _tail = next;
+            tail = next;
+            next = next->next.loadAcquire();
+        }
+
+        if (next == nullptr) {
+            if (tail != _head.loadAcquire())
+                return false;
+
+            // tail is the last real node; put the stub behind it so it can
+            // be unlinked
+            push(&_stub);
+            next = tail->next.loadAcquire();
+            if (next == nullptr)
+                return false;
+        }
+
+        _tail = next;
+
+        Node * node = static_cast<Node *>(tail);
+        message = node->message;
+        delete node;
+
+        _pending.deref();
+        return true;
+    }
+
+private:
+    void push (Link * link) {
+        link->next.storeRelease(nullptr);
+        Link * previous = _head.fetchAndStoreOrdered(link);
+        previous->next.storeRelease(link);
+    }
+
+private:
+    QAtomicPointer<Link> _head; // producers
+    Link * _tail; // consumer only
+    Link _stub;
+};
+
+#endif
@@ -0,0 +1,73 @@
+//
+// thinkerlistener.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERLISTENER_H
+#define THINKERQT_THINKERLISTENER_H
+
+//
+// ThinkerListener
+//
+// A listener is the lowest-level way of hearing about a thinker's progress.
+// It is not a QObject and there are no signals involved: the thinker calls
+// straight into it.  ThinkerPresentWatcher is built on top of this, but it
+// is also how notifications get bridged to things that aren't Qt at all.
+//
+// Because the calls are made on the thinker's thread (and with the thinker
+// waiting on you to return) the implementations must be cheap and must not
+// block.  Typically they set a flag or poke a throttler and get out.
+//
+
+class ThinkerListener
+{
+public:
+    virtual ~ThinkerListener ()
+    {
+    }
+
+public:
+    // Called on the thinker's thread after each unlock(), once the write
+    // lock has been released.
+
+    virtual void thinkerWritten () = 0;
+
+    // Called once when the runner is done with the thinker, whether it
+    // finished or was canceled.  If the listener is attached to a thinker
+    // that has already retired, it is called during the attachment.
+
+    virtual void thinkerRetired (bool wasCanceled) = 0;
+
+    // Called on the thinker's thread when it reports progress, which does
+    // not count as a write (see ThinkerBase::setProgressValue).  Most
+    // listeners don't care, so it does nothing by default.
+
+    virtual void thinkerProgressed ()
+    {
+    }
+
+    // Called on the thinker's thread after it appends to its result log (see
+    // ThinkerBase::reportResult).  Also does nothing by default.
+
+    virtual void thinkerResultsReported ()
+    {
+    }
+};
+
+#endif
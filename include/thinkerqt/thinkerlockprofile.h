@@ -0,0 +1,292 @@
+//
+// thinkerlockprofile.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERLOCKPROFILE_H
+#define THINKERQT_THINKERLOCKPROFILE_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+#include <climits>
+
+#include "defs.h"
+#include "latencyhistogram.h"
+
+//
+// ThinkerLockProfile
+//
+// Which of the library's locks threads are queueing up on depends on the
+// workload, and it's hard to guess.  The locks below are wrapped so that,
+// once profiling is enabled, each acquisition is counted against its site
+// (all runners' _stateMutex are one site, for instance) along with how
+// long it waited and how long the lock was then held.  Time spent waiting
+// on a QWaitCondition doesn't count as holding.
+//
+// While disabled, which is the default, a lock costs one test of an atomic
+// flag more than the plain Qt one.  Counters are atomics, so profiling
+// adds no locking of its own.  A manager being destroyed with profiling
+// enabled dumps reportText() with qDebug().
+//
+
+struct ThinkerLockStats
+{
+    char const * name; // e.g. "ThinkerRunner::_stateMutex"
+    quint64 acquisitions;
+    quint64 contended; // had to wait
+    qint64 waitNsecs; // total
+    LatencyHistogram waitHistogram; // all acquisitions, uncontended as 0
+    qint64 holdNsecs; // total
+    qint64 maxHoldNsecs;
+};
+
+
+class ThinkerLockProfile
+{
+public:
+    enum class Site {
+        ManagerMaps,
+        ManagerPushThread,
+        ManagerDemand,
+        ManagerOrphan,
+        ManagerCache,
+        RunnerState,
+        SnapshottableData,
+        ThinkerListeners,
+        ThinkerVersion
+    };
+
+    enum {
+        SiteCount = static_cast<int>(Site::ThinkerVersion) + 1
+    };
+
+
+public:
+    static void setEnabled (bool enabled);
+
+    static bool isEnabled () {
+        return _enabled.loadAcquire() != 0;
+    }
+
+
+public:
+    static ThinkerLockStats stats (Site site);
+
+    // Sites with any acquisitions, most total waiting first
+    static QVector<ThinkerLockStats> report ();
+
+    static QString reportText ();
+
+    static void reset ();
+
+
+private:
+    friend class ThinkerMutex;
+    friend class ThinkerReadWriteLock;
+    friend class ThinkerReadLocker;
+
+    static qint64 now (); // never 0, so 0 can mean "not timed"
+
+    static void acquired (Site site, qint64 waitedNsecs, bool contended);
+
+    static void released (Site site, qint64 heldNsecs);
+
+    static QAtomicInt _enabled;
+};
+
+
+//
+// ThinkerMutex
+//
+// A QMutex counted against a ThinkerLockProfile site.  Use it with
+// ThinkerMutexLocker, and wait on conditions with waitOn().  It inherits
+// privately so it can't be handed to QMutexLocker or QWaitCondition by
+// mistake, which would go around the profiling.
+//
+
+class ThinkerMutex : private QMutex
+{
+public:
+    explicit ThinkerMutex (
+        ThinkerLockProfile::Site site,
+        QMutex::RecursionMode mode = QMutex::NonRecursive
+    ) :
+        QMutex (mode),
+        _site (site),
+        _depth (0),
+        _heldSince (0)
+    {
+    }
+
+public:
+    void lock () {
+        if (ThinkerLockProfile::isEnabled()) {
+            lockProfiled();
+            return;
+        }
+        QMutex::lock();
+        if (_depth++ == 0)
+            _heldSince = 0;
+    }
+
+    void unlock () {
+        if ((--_depth == 0) and (_heldSince != 0))
+            releaseProfiled();
+        QMutex::unlock();
+    }
+
+    // Must be locked once (not recursively) by the caller
+    bool waitOn (QWaitCondition & condition, unsigned long time = ULONG_MAX);
+
+private:
+    void lockProfiled ();
+
+    void releaseProfiled ();
+
+private:
+    ThinkerLockProfile::Site const _site;
+    int _depth; // these two only touched by the holder
+    qint64 _heldSince;
+};
+
+
+class ThinkerMutexLocker
+{
+public:
+    explicit ThinkerMutexLocker (ThinkerMutex * mutex) :
+        _mutex (mutex),
+        _locked (false)
+    {
+        relock();
+    }
+
+    ThinkerMutexLocker (ThinkerMutexLocker const & other) = delete;
+
+    ~ThinkerMutexLocker ()
+    {
+        if (_locked)
+            unlock();
+    }
+
+public:
+    void unlock () {
+        _mutex->unlock();
+        _locked = false;
+    }
+
+    void relock () {
+        _mutex->lock();
+        _locked = true;
+    }
+
+private:
+    ThinkerMutex * _mutex;
+    bool _locked;
+};
+
+
+//
+// ThinkerReadWriteLock
+//
+// The same for a QReadWriteLock.  Write holds are timed by the lock itself
+// and read holds by ThinkerReadLocker, as there may be many readers.
+//
+
+class ThinkerReadWriteLock : private QReadWriteLock
+{
+public:
+    explicit ThinkerReadWriteLock (ThinkerLockProfile::Site site) :
+        QReadWriteLock (),
+        _site (site),
+        _writeHeldSince (0)
+    {
+    }
+
+public:
+    void lockForRead () {
+        if (ThinkerLockProfile::isEnabled())
+            lockProfiled(false);
+        else
+            QReadWriteLock::lockForRead();
+    }
+
+    void lockForWrite () {
+        if (ThinkerLockProfile::isEnabled()) {
+            lockProfiled(true);
+            return;
+        }
+        QReadWriteLock::lockForWrite();
+        _writeHeldSince = 0;
+    }
+
+    // Readers always see _writeHeldSince as 0, as the writer clears it
+    // before letting them in
+    void unlock () {
+        if (_writeHeldSince != 0)
+            releaseWriteProfiled();
+        QReadWriteLock::unlock();
+    }
+
+private:
+    friend class ThinkerReadLocker;
+
+    void lockProfiled (bool forWrite);
+
+    void releaseWriteProfiled ();
+
+private:
+    ThinkerLockProfile::Site const _site;
+    qint64 _writeHeldSince; // only touched by the writer
+};
+
+
+class ThinkerReadLocker
+{
+public:
+    explicit ThinkerReadLocker (ThinkerReadWriteLock * lock) :
+        _lock (lock),
+        _heldSince (0)
+    {
+        _lock->lockForRead();
+        if (ThinkerLockProfile::isEnabled())
+            _heldSince = ThinkerLockProfile::now();
+    }
+
+    ThinkerReadLocker (ThinkerReadLocker const & other) = delete;
+
+    ~ThinkerReadLocker ()
+    {
+        if (_heldSince != 0) {
+            ThinkerLockProfile::released(
+                _lock->_site, ThinkerLockProfile::now() - _heldSince
+            );
+        }
+        _lock->unlock();
+    }
+
+private:
+    ThinkerReadWriteLock * _lock;
+    qint64 _heldSince;
+};
+
+#endif
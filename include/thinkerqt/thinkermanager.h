@@ -26,10 +26,16 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QMap>
+#include <QHash>
+#include <QVector>
+#include <QCache>
+#include <QByteArray>
 
 #include "defs.h"
 #include "thinker.h"
 #include "thinkerpresent.h"
+#include "thinkermetrics.h"
+#include "thinkerlockprofile.h"
 
 class ThinkerRunner;
 class ThinkerRunnerHelper;
@@ -72,6 +78,41 @@ public:
 
 
 public:
+#if THINKERQT_NO_CHECKS
+    // Compiled away (see defs.h)
+
+    bool hopefullyThreadIsManager (QThread const &, codeplace const &) {
+        return true;
+    }
+
+    bool hopefullyCurrentThreadIsManager (codeplace const &) {
+        return true;
+    }
+
+    bool hopefullyThreadIsNotManager (QThread const &, codeplace const &) {
+        return true;
+    }
+
+    bool hopefullyCurrentThreadIsNotManager (codeplace const &) {
+        return true;
+    }
+
+    bool hopefullyThreadIsNotThinker (QThread const &, codeplace const &) {
+        return true;
+    }
+
+    bool hopefullyCurrentThreadIsNotThinker (codeplace const &) {
+        return true;
+    }
+
+    bool hopefullyThreadIsThinker (QThread const &, codeplace const &) {
+        return true;
+    }
+
+    bool hopefullyCurrentThreadIsThinker (codeplace const &) {
+        return true;
+    }
+#else
     bool hopefullyThreadIsManager (
         QThread const & thread,
         codeplace const & cp
@@ -100,6 +141,7 @@ public:
     );
 
     bool hopefullyCurrentThreadIsThinker (codeplace const & cp);
+#endif
 
 
 public:
@@ -134,6 +176,131 @@ protected:
     friend class ThinkerBase;
 
 
+    // Thinkers that opted in with setAutoPauseWhenUnwatched() are paused when
+    // their last active watcher goes away, once the grace period has passed
+    // without one coming back.  Watchers change on arbitrary threads, but
+    // pausing and resuming must be requested from the manager thread, so the
+    // changes are queued up and handled like thread pushes are.
+public:
+    void setUnwatchedGracePeriod (int milliseconds);
+
+signals:
+    void demandCheckMayBeNeeded ();
+
+private slots:
+    void doDemandChecks ();
+
+private:
+    void watcherDemandChanged (ThinkerBase & thinker);
+
+    void pauseIfStillUnwatched (
+        shared_ptr<ThinkerRunner> runner,
+        int demandGeneration
+    );
+
+
+    // Following QFuture, dropping the last Present does not cancel a thinker
+    // by default.  In orphan-detection mode it does: the runner is queued to
+    // the manager thread, and if no Present has appeared for the thinker in
+    // the meantime it gets a cancellation request.
+public:
+    void setCancelOrphanedThinkers (bool cancelOrphans);
+
+signals:
+    void orphanCheckMayBeNeeded ();
+
+private slots:
+    void doOrphanChecks ();
+
+private:
+    void thinkerOrphaned (ThinkerBase & thinker);
+
+
+    // Memoized results.  Thinkers that provide a cacheKey() have their final
+    // snapshot remembered once they finish (not when they are canceled);
+    // the thinker itself is let go as usual.  Running another thinker of the
+    // same type with an equal key then never starts it.  It takes on the
+    // cached data instead, and its Present is finished from the start.  Only
+    // the data is carried over, not progress or reported results.  The least
+    // recently used results are dropped to keep the total cacheCost() under
+    // the budget, which is zero--no caching--by default.
+    //
+    // Keyed thinkers are also coalesced while they are in flight, whether
+    // or not there is a cache budget.  If an equal one is queued or running,
+    // run() returns a Present to it and counts the caller as another sharer.
+    // Canceling through a sharer's Presents only cancels the thinker once
+    // every sharer has done so.
+    //
+    // The cache is only ever touched on the manager thread, so run() never
+    // takes a lock to look in it.  Thinkers finish on pool threads, so they
+    // are queued over to be added, like the other checks above.
+public:
+    void setResultCacheBudget (int bytes);
+
+    void clearResultCache ();
+
+signals:
+    void cacheInsertMayBeNeeded ();
+
+private slots:
+    void doCacheInserts ();
+
+private:
+    // A thinker with an equal key in flight is joined and handed back.  A
+    // hit in the result cache gives null, but finishes the thinker passed
+    // in with the cached data, so it must not be run.
+    shared_ptr<ThinkerBase> maybeGetSharedThinker (ThinkerBase & thinker);
+
+    static bool finishedFromCache (ThinkerBase const & thinker);
+
+    struct CachedResult {
+        shared_ptr<SnapshotBase> snapshot;
+    };
+
+
+    // Lifecycle metrics (see ThinkerMetrics).  Enabling only affects thinkers
+    // run afterward; each runner decides when it is made.  Totals may be
+    // read and reset from any thread.
+public:
+    void setMetricsEnabled (bool enabled);
+
+    bool metricsEnabled () const {
+        return _metricsEnabled.loadAcquire() != 0;
+    }
+
+    ThinkerMetricsTotals metricsTotals () const;
+
+    void resetMetricsTotals ();
+
+
+    // Memory held by thinkers' data (see SnapshottableMemoryUsage).  The
+    // pinned counts in the total include versions left behind by thinkers
+    // that are gone, since Snapshots can outlive them.  The holders are the
+    // thinkers still alive, most pinned bytes first.  A report doesn't keep
+    // its thinker alive or count as a Present to it; the handle is only for
+    // telling which thinker it was, and is empty once that thinker is gone.
+    // Both are asked on the manager thread, and take each thinker's read
+    // lock in turn.
+public:
+    struct MemoryHolder {
+        std::weak_ptr<ThinkerBase const> thinker;
+        SnapshottableMemoryUsage usage;
+    };
+
+    SnapshottableMemoryUsage memoryUsage ();
+
+    QVector<MemoryHolder> largestMemoryHolders (int count);
+
+private:
+    void trackThinker (shared_ptr<ThinkerBase> holder);
+
+    void forgetThinker (ThinkerBase & thinker);
+
+    // Any of these may be the last reference, and dropping it would have the
+    // thinker forgotten, so they're taken before looking instead of during
+    QVector<shared_ptr<ThinkerBase>> lockTrackedThinkers ();
+
+
 private:
     void createRunnerForThinker (
         shared_ptr<ThinkerBase> holder,
@@ -141,11 +308,9 @@ private:
     );
 
 
-public:
-    // https://github.com/hostilefork/thinker-qt/issues/5
-
+private:
     template <class ThinkerType>
-    typename ThinkerType::Present run (
+    static shared_ptr<ThinkerType> makeHolder (
         unique_ptr<ThinkerType> holder,
         codeplace const & cp
     ) {
@@ -158,7 +323,7 @@ public:
         // actually be the one to perform the deletion (it will happen on
         // whichever thread happens to be the last one to release a reference).
         // A custom deleter addresses this and we use Qt's "deleteLater()"
-        shared_ptr<ThinkerType> shared (
+        return shared_ptr<ThinkerType> (
             holder.release(),
             [] (ThinkerType* thinker) {
                 if (thinker == nullptr) {
@@ -171,8 +336,25 @@ public:
                     thinker->deleteLater();
             }
         );
+    }
+
 
-        createRunnerForThinker(shared, cp);
+public:
+    // https://github.com/hostilefork/thinker-qt/issues/5
+
+    template <class ThinkerType>
+    typename ThinkerType::Present run (
+        unique_ptr<ThinkerType> holder,
+        codeplace const & cp
+    ) {
+        shared_ptr<ThinkerBase> existing = maybeGetSharedThinker(*holder);
+        if (existing)
+            return typename ThinkerType::Present (existing);
+
+        shared_ptr<ThinkerType> shared = makeHolder(std::move(holder), cp);
+
+        if (not finishedFromCache(*shared))
+            createRunnerForThinker(shared, cp);
 
         return typename ThinkerType::Present (shared);
     }
@@ -184,34 +366,102 @@ public:
         unique_ptr<ThinkerType> holder, 
         codeplace const & cp
     ) {
-        // It's a QObject, but we're taking ownership...
-        hopefully(not holder->parent(), cp); 
+        shared_ptr<ThinkerBase> existing = maybeGetSharedThinker(*holder);
+        if (existing)
+            return ThinkerPresentBase (existing);
 
-        // We only want to run the destructor of the Thinker on the thread
-        // where it was created.  But if we use shared_ptr to a Thinker then
-        // that means we are surrendering the control of which thread will
-        // actually be the one to perform the deletion (it will happen on
-        // whichever thread happens to be the last one to release a reference).
-        // A custom deleter addresses this and we use Qt's "deleteLater()"
-        shared_ptr<ThinkerType> shared (
-            holder.release(),
-            [] (ThinkerType* thinker) {
-                if (thinker == nullptr) {
-                    return;
-                }
+        shared_ptr<ThinkerType> shared = makeHolder(std::move(holder), cp);
 
-                if (thinker->thread() == QThread::currentThread())
-                    delete thinker;
-                else
-                    thinker->deleteLater();
-            }
+        if (not finishedFromCache(*shared))
+            createRunnerForThinker(shared, cp);
+
+        return ThinkerPresentBase (shared);
+    }
+
+
+    // Continuations.  Rather than have a watcher on the GUI thread catch
+    // finished() and call run() for the next stage, the next stage can be
+    // handed over now along with the Presents it depends on.  When its
+    // inputs retire, whichever pool thread retired the last one needed puts
+    // it in the thread pool directly--the manager thread is not involved.
+    // The final snapshots of the inputs are available to it through
+    // ThinkerBase::inputSnapshot() by the time its start() runs.
+    //
+    // If an input of then() or whenAll() is canceled, so is the
+    // continuation.  whenAny() launches on the first input to finish, and is
+    // canceled only if all of them are.
+
+    template <class ThinkerType>
+    typename ThinkerType::Present then (
+        ThinkerPresentBase input,
+        unique_ptr<ThinkerType> holder,
+        codeplace const & cp
+    ) {
+        return whenAll(
+            QVector<ThinkerPresentBase> (1, input), std::move(holder), cp
         );
+    }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present whenAll (
+        QVector<ThinkerPresentBase> inputs,
+        unique_ptr<ThinkerType> holder,
+        codeplace const & cp
+    ) {
+        shared_ptr<ThinkerType> shared = makeHolder(std::move(holder), cp);
 
-        createRunnerForThinker(shared, cp);
+        createContinuationForThinker(shared, inputs, true, cp);
 
-        return ThinkerPresentBase (shared);
+        return typename ThinkerType::Present (shared);
+    }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present whenAny (
+        QVector<ThinkerPresentBase> inputs,
+        unique_ptr<ThinkerType> holder,
+        codeplace const & cp
+    ) {
+        shared_ptr<ThinkerType> shared = makeHolder(std::move(holder), cp);
+
+        createContinuationForThinker(shared, inputs, false, cp);
+
+        return typename ThinkerType::Present (shared);
     }
 
+private:
+    void createContinuationForThinker (
+        shared_ptr<ThinkerBase> holder,
+        QVector<ThinkerPresentBase> inputs,
+        bool needsAllInputs,
+        codeplace const & cp
+    );
+
+    friend class ThinkerContinuation;
+
+
+public:
+    // Block a coordinator thread (not the manager thread) until any one of
+    // the Presents has finished or been canceled, or until all of them
+    // have.  waitForAny() gives back the index of one that is done, or -1 if
+    // the time ran out; waitForAll() returns false if the time ran out.  To
+    // reap a big batch as it completes, a ThinkerCompletionQueue is cheaper
+    // than calling waitForAny() over and over.
+    //
+    // Each call registers a retirement callback on the thinkers it waits
+    // for (and removes them when it returns), so a retirement only wakes
+    // the waits that are looking at that thinker.
+
+    int waitForAny (
+        QVector<ThinkerPresentBase> const & presents,
+        unsigned long time = ULONG_MAX
+    );
+
+    bool waitForAll (
+        QVector<ThinkerPresentBase> const & presents,
+        unsigned long time = ULONG_MAX
+    );
+
+
 public:
     void ensureThinkersPaused (codeplace const & cp);
 
@@ -226,6 +476,30 @@ public:
         return run(std::move(thinker), HERE);
     }
 
+    template <class ThinkerType>
+    typename ThinkerType::Present then (
+        ThinkerPresentBase input,
+        unique_ptr<ThinkerType>&& thinker
+    ) {
+        return then(input, std::move(thinker), HERE);
+    }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present whenAll (
+        QVector<ThinkerPresentBase> inputs,
+        unique_ptr<ThinkerType>&& thinker
+    ) {
+        return whenAll(inputs, std::move(thinker), HERE);
+    }
+
+    template <class ThinkerType>
+    typename ThinkerType::Present whenAny (
+        QVector<ThinkerPresentBase> inputs,
+        unique_ptr<ThinkerType>&& thinker
+    ) {
+        return whenAny(inputs, std::move(thinker), HERE);
+    }
+
     void ensureThinkersPaused () {
         ensureThinkersPaused(HERE);
     }
@@ -270,6 +544,8 @@ public:
         QThread & thread
     );
 
+    void addToMetricsTotals (ThinkerMetrics const & metrics, bool wasCanceled);
+
 
     // Runners are like "tasks".  There is not necessarily a one-to-one
     // correspondence between Runners and thinkers.  So you must be
@@ -287,18 +563,43 @@ private:
     );
 
     friend class ThinkerPresentBase;
+    friend class ThinkerGraph;
 
 
 private:
     SignalThrottler _anyThinkerWrittenThrottler;
-    QMutex _mapsMutex;
+    ThinkerMutex _mapsMutex;
+    // Only for other threads; the current one's runner is found with
+    // ThinkerRunner::currentMaybeNull()
     QMap<QThread const *, shared_ptr<ThinkerRunner>> _threadMap;
     QMap<ThinkerBase const *, shared_ptr<ThinkerRunner>> _thinkerMap;
+    QHash<QByteArray, shared_ptr<ThinkerRunner>> _inFlightMap; // keyed ones
 
-    QMutex _pushThreadMutex;
+    ThinkerMutex _pushThreadMutex;
     QWaitCondition _threadsWerePushed;
     QWaitCondition _threadsNeedPushing;
     QSet<ThinkerRunner *> _runnerSetToPush;
+
+    int _unwatchedGracePeriod; // manager thread only
+    ThinkerMutex _demandMutex;
+    QVector<shared_ptr<ThinkerRunner>> _runnersToCheckDemand;
+
+    QAtomicInt _cancelOrphans; // read when Presents die, on any thread
+    ThinkerMutex _orphanMutex;
+    QVector<shared_ptr<ThinkerRunner>> _runnersToCheckOrphaned;
+
+    QCache<QByteArray, CachedResult> _resultCache; // manager thread only
+    QAtomicInt _cachingResults; // if the budget isn't zero; read anywhere
+    ThinkerMutex _cacheMutex;
+    QVector<shared_ptr<ThinkerRunner>> _runnersToCache;
+
+    QAtomicInt _metricsEnabled;
+    mutable QMutex _metricsMutex;
+    ThinkerMetricsTotals _metricsTotals; // guarded by _metricsMutex
+
+    shared_ptr<SnapshotMemoryCounters> _snapshotMemory;
+    // Every thinker given a runner, until it is destroyed; manager thread only
+    QHash<ThinkerBase const *, std::weak_ptr<ThinkerBase>> _thinkers;
 };
 
 #endif
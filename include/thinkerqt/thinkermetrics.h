@@ -0,0 +1,117 @@
+//
+// thinkermetrics.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERMETRICS_H
+#define THINKERQT_THINKERMETRICS_H
+
+#include <QtGlobal>
+
+#include "defs.h"
+
+//
+// ThinkerMetrics
+//
+// Where a thinker's wall time went, from being queued to finishing or being
+// canceled.  Collection is off by default; turn it on with
+// ThinkerManager::setMetricsEnabled() before running the thinkers of
+// interest.  A runner made while it is off only tests a bool at each state
+// transition, and its timings all read as zero.  The publish and detach
+// counts are kept by the thinker's data regardless, as they cost nothing
+// extra.
+//
+// All times are in nanoseconds.  CPU time is per thread, and reads as zero
+// on platforms without CLOCK_THREAD_CPUTIME_ID.
+//
+
+struct ThinkerMetrics
+{
+    ThinkerMetrics () :
+        queueWaitNsecs (0),
+        threadPushNsecs (0),
+        thinkingWallNsecs (0),
+        thinkingCpuNsecs (0),
+        pauseLatencyNsecs (0),
+        pauseCount (0),
+        publishCount (0),
+        bytesDetached (0)
+    {
+    }
+
+    // From run() until a pool thread picked the thinker up (time spent
+    // paused before it ever started is included)
+    qint64 queueWaitNsecs;
+
+    // From being picked up until the manager thread pushed the thinker over
+    // to the pool thread
+    qint64 threadPushNsecs;
+
+    // Inside start() and the thinker's event loop, not counting pauses
+    qint64 thinkingWallNsecs;
+    qint64 thinkingCpuNsecs;
+
+    // Summed over every pause, from the request until the thinker noticed
+    // it and reached Paused
+    qint64 pauseLatencyNsecs;
+    int pauseCount;
+
+    // Each unlock of the write lock publishes a version.  A write made while
+    // a snapshot still shares the data copies it first; that is counted as
+    // the size of the data object plus what its heapBytes() reports (see
+    // SnapshottableMemoryUsage).
+    quint64 publishCount;
+    quint64 bytesDetached;
+
+    ThinkerMetrics & operator+= (ThinkerMetrics const & other) {
+        queueWaitNsecs += other.queueWaitNsecs;
+        threadPushNsecs += other.threadPushNsecs;
+        thinkingWallNsecs += other.thinkingWallNsecs;
+        thinkingCpuNsecs += other.thinkingCpuNsecs;
+        pauseLatencyNsecs += other.pauseLatencyNsecs;
+        pauseCount += other.pauseCount;
+        publishCount += other.publishCount;
+        bytesDetached += other.bytesDetached;
+        return *this;
+    }
+};
+
+
+//
+// ThinkerMetricsTotals
+//
+// Manager-wide sums over every thinker that ran to completion or was
+// canceled while metrics were enabled.  Divide by the counts for averages.
+//
+
+struct ThinkerMetricsTotals
+{
+    ThinkerMetricsTotals () :
+        finishedCount (0),
+        canceledCount (0),
+        sum ()
+    {
+    }
+
+    int finishedCount;
+    int canceledCount;
+    ThinkerMetrics sum;
+};
+
+#endif
@@ -23,9 +23,15 @@
 #define THINKERQT_THINKERPRESENT_H
 
 #include <QThread>
+#include <QAtomicInt>
+#include <QString>
+#include <climits>
 
 #include "defs.h"
 #include "snapshottable.h"
+#include "resultlog.h"
+#include "thinkerinbox.h"
+#include "thinkermetrics.h"
 
 class ThinkerBase;
 class ThinkerManager;
@@ -67,8 +73,21 @@ public:
 
 protected:
     friend class ThinkerPresentWatcherBase;
-
+    friend class ThinkerEventNotifier;
+    friend class ThinkerGroupWatcher;
+    friend class ThinkerGraph;
+    friend class ThinkerCompletionQueue;
+    friend class ThinkerRetirementWait;
+    friend class ThinkerBase;
+
+#if THINKERQT_NO_CHECKS
+    // Compiled away (see defs.h)
+    bool hopefullyCurrentThreadIsDifferent (codeplace const &) const {
+        return true;
+    }
+#else
     bool hopefullyCurrentThreadIsDifferent (codeplace const & cp) const;
+#endif
 
 
 protected:
@@ -80,24 +99,83 @@ protected:
 
 
 public:
-    // QFuture thinks of returning a list of results, whereas we snapshot
-#if RETURN_LIST_OF_RESULTS_LIKE_QFUTURE
-
-    T result () const;
+    SnapshotBase * createSnapshotBase () const;
 
-    operator T () const;
 
-    T resultAt (int index) const;
+public:
+    // QFuture thinks of returning a list of results, whereas we snapshot.
+    // But a thinker may also report a stream of results on the side (see
+    // ThinkerBase::reportResult), and those are read here without copying.
+    // The references stay good for as long as you hold a Present.  R must be
+    // the type the thinker reports.
 
     int resultCount () const;
 
-    QList<T> results () const;
+    bool isResultReadyAt (int index) const {
+        return (index >= 0) and (index < resultCount());
+    }
 
-    bool isResultReadyAt (int index) const;
+    template <class R>
+    R const & resultAt (int index) const {
+        return resultLog<R>()->at(index);
+    }
 
-#endif
+    // A cursor may be made before anything is reported, and will pick up
+    // the results as they come.  It keeps the thinker alive (though not
+    // running, if it is orphaned), so it may outlive the Present and be
+    // handed to another thread.
+    template <class R>
+    typename ResultLog<R>::Cursor resultCursor (int position = 0) const {
+        return typename ResultLog<R>::Cursor (_holder, resultSlot(), position);
+    }
 
-    SnapshotBase * createSnapshotBase () const;
+private:
+    QAtomicPointer<ResultLogBase> const & resultSlot () const;
+
+    template <class R>
+    ResultLog<R> const * resultLog () const {
+        ResultLogBase const * base = resultSlot().loadAcquire();
+        hopefully(base != nullptr, HERE);
+
+        ResultLog<R> const * log = dynamic_cast<ResultLog<R> const *>(base);
+        hopefully(log != nullptr, HERE);
+        return log;
+    }
+
+
+public:
+    // Tell a running thinker something (a new viewport, a tighter bound)
+    // without canceling it.  The thinker takes messages when it polls for
+    // pause requests (see ThinkerBase::takeMessage).  M must be the same
+    // type for every message posted to a thinker.  Posting takes no locks
+    // unless the thinker is asleep in wasPauseRequested(time) and must be
+    // woken, and may be done from any thread but the thinker's own.
+
+    template <class M>
+    void postMessage (M const & message) {
+        hopefullyCurrentThreadIsDifferent(HERE);
+
+        ThinkerInbox<M>::ensure(inboxSlot())->post(message);
+        messagePosted();
+    }
+
+private:
+    QAtomicPointer<ThinkerInboxBase> & inboxSlot ();
+
+    void messagePosted ();
+
+
+public:
+    // Timings as of the thinker's last state transition, plus live publish
+    // and detach counts.  Zero timings unless the manager had metrics
+    // enabled when the thinker was run (see ThinkerMetrics).
+
+    ThinkerMetrics metrics () const;
+
+    // The thinker's data and the older versions of it that Snapshots are
+    // keeping alive (see SnapshottableMemoryUsage)
+
+    SnapshottableMemoryUsage memoryUsage () const;
 
 
 public:
@@ -112,6 +190,12 @@ public:
 
 #endif
 
+    // These read a status word the runner keeps up to date, so they may be
+    // called from any thread, including the thinker's own.  A canceled
+    // thinker is also finished, whether or not it ever got a runner.  While
+    // a cancel is still being honored the thinker is canceled but not yet
+    // finished; waitForFinished() is what to use to be sure it has stopped.
+
     bool isCanceled () const;
 
     bool isFinished () const;
@@ -134,9 +218,24 @@ public:
 
 
 public:
-    // TODO: Should Thinkers implement a progress API like QFuture?
-    // QFuture's does not apply to run() interfaces...
-#if OFFER_PROGRESS_API_LIKE_QFUTURE
+    // For consumer threads that have no event loop, and so can't use a
+    // PresentWatcher.  version() is bumped on each unlock() of the thinker.
+    // waitForVersionAfter() sleeps until a version newer than the one given
+    // is published, the thinker finishes or is canceled, or the time (in
+    // milliseconds) runs out.  It returns true only if there is newer data.
+
+    quint64 version () const;
+
+    bool waitForVersionAfter (
+        quint64 version,
+        unsigned long time = ULONG_MAX
+    );
+
+
+public:
+    // Like QFuture's progress API, but fed by the thinker's own progress
+    // channel (see ThinkerBase::setProgressValue) rather than by results.
+    // Reading it never touches the snapshot machinery.
 
     int progressMaximum () const;
 
@@ -146,12 +245,21 @@ public:
 
     int progressValue () const;
 
-#endif
+
+private:
+    void holderAcquired ();
+
+    void holderReleased ();
 
 
 protected:
     shared_ptr<ThinkerBase> _holder;
 
+    // Common to all the copies of the Present one run() call handed out, so
+    // that call is counted once as a sharer no matter how many of its copies
+    // get canceled.  Set to 1 when it has left.
+    shared_ptr<QAtomicInt> _sharerLeft;
+
     // Should this be DEBUG only?
     QThread * _thread;
 };
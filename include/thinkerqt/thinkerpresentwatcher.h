@@ -27,7 +27,9 @@
 
 #include "defs.h"
 #include "thinkerpresent.h"
+#include "thinkerlistener.h"
 #include "signalthrottler.h"
+#include "latencyhistogram.h"
 
 class ThinkerBase;
 class ThinkerManager;
@@ -41,7 +43,7 @@ class ThinkerManager;
 // ThinkerPresent
 //
 
-class ThinkerPresentWatcherBase : public QObject
+class ThinkerPresentWatcherBase : public QObject, private ThinkerListener
 {
     Q_OBJECT
 
@@ -56,20 +58,80 @@ signals:
 
     void finished ();
 
+    // Throttled on its own, so a thinker reporting progress often doesn't
+    // make the written() handlers (which usually take a snapshot) run
+    void progressChanged ();
+
+    // New items in the thinker's result log; read them with a cursor from
+    // the Present.  Shares the throttle time of written().
+    void resultsReported ();
+
 
 public:
     void setThrottleTime (unsigned int milliseconds);
 
+    void setProgressThrottleTime (unsigned int milliseconds);
+
     void setPresentBase (ThinkerPresentBase present);
 
     ThinkerPresentBase presentBase ();
 
 
 public:
-    SnapshotBase const * createSnapshotBase () const {
-        return _present.createSnapshotBase();
+    // An inactive watcher is still attached and still gets its signals, but
+    // it doesn't count as someone looking at the thinker.  Mark a watcher
+    // inactive when its view is hidden, so thinkers that opted in to
+    // setAutoPauseWhenUnwatched() can be paused.
+
+    void setActive (bool active);
+
+    bool isActive () const {
+        return _active;
+    }
+
+
+public:
+    SnapshotBase * createSnapshotBase () const;
+
+
+public:
+    // Where the time goes between a thinker publishing a write and this
+    // watcher's consumer having it in hand, for chasing down UI lag.  With
+    // tracing on, the first write the consumer hasn't seen yet is stamped,
+    // and so are the throttled emit, the delivery of written() on this
+    // watcher's thread, and the snapshot.  The consumer must take its
+    // snapshot through the watcher for it to count.  The stages are:
+    //
+    // * Throttle: write until the throttler fired (throttle time, mostly)
+    // * Dispatch: fired until written() ran here (event loop backlog)
+    // * Handler: written() until the snapshot was asked for (slot work)
+    // * Snapshot: the snapshot itself
+    // * Total: write until the snapshot was in hand
+    //
+    // Snapshots taken without a delivered written() only count toward
+    // Snapshot, and Total if there was a write pending.
+
+    enum class LatencyStage {
+        Throttle,
+        Dispatch,
+        Handler,
+        Snapshot,
+        Total
+    };
+
+    void setLatencyTracing (bool tracing);
+
+    bool isLatencyTracing () const {
+        return _latencyTrace != nullptr;
     }
 
+    LatencyHistogram latencyHistogram (LatencyStage stage) const;
+
+    void resetLatencyHistograms ();
+
+private slots:
+    void latencyDelivered ();
+
 
 public:
     bool isCanceled () const {
@@ -85,6 +147,24 @@ public:
     }
 
 
+public:
+    int progressMaximum () const {
+        return _present.progressMaximum();
+    }
+
+    int progressMinimum () const {
+        return _present.progressMinimum();
+    }
+
+    QString progressText () const {
+        return _present.progressText();
+    }
+
+    int progressValue () const {
+        return _present.progressValue();
+    }
+
+
 public slots:
     void cancel () {
         _present.cancel();
@@ -118,6 +198,19 @@ private:
     void doDisconnections ();
 
 
+private:
+    // Writes are funneled into the throttler here, on the thinker's thread.
+    // The finished() signal is driven by the thinker's done() signal.
+
+    void thinkerWritten () override;
+
+    void thinkerRetired (bool wasCanceled) override;
+
+    void thinkerProgressed () override;
+
+    void thinkerResultsReported () override;
+
+
 protected:
     friend class ThinkerManager;
 
@@ -126,11 +219,16 @@ protected:
 
 protected:
     bool hopefullyCurrentThreadIsDifferent(codeplace const & cp) const {
+#if THINKERQT_NO_CHECKS
+        Q_UNUSED(cp);
+        return true;
+#else
         if (_present == ThinkerPresentBase()) {
             return true;
         } else {
             return _present.hopefullyCurrentThreadIsDifferent(cp);
         }
+#endif
     }
 
 
@@ -144,9 +242,17 @@ protected:
 
 protected:
     ThinkerPresentBase _present;
+    bool _active;
     unsigned int _milliseconds;
+    unsigned int _progressMilliseconds;
     QSharedPointer<SignalThrottler> _notificationThrottler;
+    QSharedPointer<SignalThrottler> _progressThrottler;
+    QSharedPointer<SignalThrottler> _resultsThrottler;
     friend class ThinkerBase;
+
+private:
+    struct LatencyTrace;
+    shared_ptr<LatencyTrace> _latencyTrace; // changed only while detached
 };
 
 #endif
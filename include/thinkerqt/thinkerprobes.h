@@ -0,0 +1,65 @@
+//
+// thinkerprobes.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERPROBES_H
+#define THINKERQT_THINKERPROBES_H
+
+#include "defs.h"
+
+//
+// USDT probes
+//
+// With THINKERQT_USDT=1 the library carries Linux user-level static
+// tracepoints in the "thinkerqt" provider.  An unattached probe is a single
+// nop, so they can stay in production builds and be attached to when
+// something goes wrong, e.g. "perf list sdt_thinkerqt:*" or the bpftrace
+// scripts in tools/bpftrace.  Without the flag they compile to nothing.
+//
+// Every probe has one argument, the address of the object concerned, which
+// is what ties a transition to the one before it:
+//
+//   enqueue, start, finish          ThinkerBase *
+//   pause_request, pause_ack        ThinkerBase *
+//   resume_request, resume_ack      ThinkerBase *
+//   cancel_request, canceled        ThinkerBase *
+//   write_lock, write_locked,       SnapshottableBase * (lockForWrite()
+//   write_unlock                    called, lock taken, unlock())
+//   snapshot                        SnapshottableBase *
+//   throttled_emit                  SignalThrottler *
+//
+// A thinker canceled before it started has a canceled with no
+// cancel_request, and one canceled while queued or paused has both at once.
+//
+
+#if THINKERQT_USDT
+
+#include <sys/sdt.h>
+
+#define THINKERQT_PROBE(name, object) \
+    DTRACE_PROBE1(thinkerqt, name, static_cast<void const *>(object))
+
+#else
+
+#define THINKERQT_PROBE(name, object) static_cast<void>(0)
+
+#endif
+
+#endif
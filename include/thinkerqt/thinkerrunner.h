@@ -28,6 +28,7 @@
 #include <QRunnable>
 #include <QEventLoop>
 #include <QTextStream>
+#include <QElapsedTimer>
 
 #include "thinkerqt/thinker.h"
 
@@ -35,7 +36,9 @@ class ThinkerRunnerHelper;
 class ThinkerManager;
 class ThinkerRunnerProxy;
 
-class ThinkerRunner : public QEventLoop
+class ThinkerRunner :
+    public QEventLoop,
+    public std::enable_shared_from_this<ThinkerRunner>
 {
     Q_OBJECT
 
@@ -68,17 +71,60 @@ public:
 
     ThinkerBase const & getThinker() const;
 
+    shared_ptr<ThinkerBase> getHolder() const {
+        return _holder;
+    }
+
+
+public:
+    // The runner whose thinker is running on the calling thread, or null.
+    // ThinkerRunnerProxy::run() keeps this in a thread_local, so asking it
+    // takes no lock.  Questions about some other thread still have to go
+    // through the manager's thread map.
+
+    static ThinkerRunner * currentMaybeNull ();
+
 
 public:
     void doThreadPushIfNecessary();
 
 
 public:
+    // A continuation's runner is created before its inputs are done, but is
+    // not handed to the thread pool until they are.  Its thinker is set
+    // adrift so the pool thread that runs it can pull it over directly.
+    // The function hands it to the pool canceled, if it's still waiting,
+    // so a cancel doesn't leave it waiting on inputs that may never retire.
+
+    void setThinkerAdrift (std::function<void ()> abandonInputs);
+
+    void cancelBeforeRun ();
+
+    void cancelIfWaitingForInputs ();
+
+
+public:
+#if THINKERQT_NO_CHECKS
+    // Compiled away (see defs.h)
+
+    bool hopefullyCurrentThreadIsRun(codeplace const &) const {
+        return true;
+    }
+
+    bool hopefullyCurrentThreadIsManager(codeplace const &) const {
+        return true;
+    }
+
+    bool hopefullyCurrentThreadIsNotThinker(codeplace const &) const {
+        return true;
+    }
+#else
     bool hopefullyCurrentThreadIsRun(codeplace const & cp) const;
 
     bool hopefullyCurrentThreadIsManager(codeplace const & cp) const;
 
     bool hopefullyCurrentThreadIsNotThinker(codeplace const & cp) const;
+#endif
 
 
 signals:
@@ -133,6 +179,22 @@ public:
     void waitForFinished (codeplace const & cp);
 
 
+public:
+    // The manager's pause for thinkers nobody is watching (see
+    // ThinkerManager::setUnwatchedGracePeriod).  It only pauses a thinker
+    // that is running or queued, and only resumes one that it paused.  Any
+    // other pause or resume request takes the pause over as the user's.
+    // Neither call waits for the thinker.
+    //
+    // A runner the pool gets to while it is QueuedButPaused, from either
+    // kind of pause, gives its pool thread back instead of waiting in it.
+    // Whoever takes it out of QueuedButPaused hands it to the pool again.
+
+    void requestAutoPause (codeplace const & cp);
+
+    void requestAutoResume (codeplace const & cp);
+
+
 public:
     bool isFinished () const;
 
@@ -147,10 +209,31 @@ public:
 #endif
 
 
+public:
+    // A nudge wakes a thinker blocked in waitForNudge() without changing its
+    // state; it is how a streaming thinker hears that an upstream wrote.  A
+    // pause or cancel request also ends the wait.  The return value says if
+    // there was a nudge (it is consumed), and nudges sent while the thinker
+    // wasn't waiting are remembered, so none are lost.
+
+    void nudge ();
+
+    bool waitForNudge (unsigned long time) const;
+
+    // Wakes the thinker if it is sleeping in wasPauseRequested(time)
+    void messagePosted ();
+
+
 protected:
     friend class ThinkerRunnerProxy;
 
-    bool runThinker();
+    enum class Outcome {
+        Finished,
+        Canceled,
+        Parked // paused before it started, so it gave up its pool thread
+    };
+
+    Outcome runThinker();
 
 
 private:
@@ -160,12 +243,33 @@ private:
         codeplace const & cp
     );
 
+    void requestPauseLocked (
+        bool isPausedOkay,
+        bool isCanceledOkay,
+        codeplace const & cp
+    );
+
     void waitForPauseCore (bool isCanceledOkay);
 
     void requestCancelCore (bool isAlreadyCanceledOkay, codeplace const & cp);
 
     void requestResumeCore (bool isCanceledOkay, codeplace const & cp);
 
+    // Called with _stateMutex held after every change to _state
+    void publishStatus ();
+
+    // Called with _stateMutex held when leaving QueuedButPaused.  Says if
+    // the runner was parked, in which case the caller must requeue() it
+    // after unlocking.
+    bool unparkLocked ();
+
+    void requeue ();
+
+    // Hands the timings gathered so far to the thinker, for its Presents
+    void publishMetrics (ThinkerMetrics const & metrics);
+
+    static char const * stateName (State state);
+
 
 #ifndef Q_NO_EXCEPTIONS
 private:
@@ -178,10 +282,37 @@ private:
 
     // for communication between one manager and one thinker so use wakeOne()
     mutable QWaitCondition _stateWasChanged;
-    mutable QMutex _stateMutex;
+    mutable ThinkerMutex _stateMutex;
+
+    // Kept separate from _stateWasChanged, whose waiters all expect a state
+    // change when they wake up.  Guarded by _stateMutex.
+    mutable QWaitCondition _nudgeArrived;
+    mutable bool _nudged;
 
     shared_ptr<ThinkerBase> _holder;
     QSharedPointer<ThinkerRunnerHelper> _helper;
+    bool _thinkerAdrift; // set on the manager thread before the pool runs us
+    std::function<void ()> _abandonInputs; // likewise
+
+    // Whether the current pause is the manager's, and whether the thinker
+    // should go right back to thinking when it gets to it because demand
+    // returned while it was Pausing.  Guarded by _stateMutex.
+    bool _autoPaused;
+    bool _resumeWhenPaused;
+
+    // Set when the pool ran us while QueuedButPaused and we gave the thread
+    // back (see Outcome::Parked).  Guarded by _stateMutex.
+    bool _parked;
+
+    // Lifecycle timings are only taken if the manager had metrics enabled
+    // when this runner was made (see ThinkerMetrics)
+    bool _metricsEnabled;
+    QElapsedTimer _metricsClock; // started when Queued
+    qint64 _pauseRequestedAt; // guarded by _stateMutex
+
+    // Likewise for tracing (see ThinkerTrace); zero if it was disabled
+    quint64 _traceTrack;
+    char const * _tracedState; // guarded by _stateMutex
 
     // http://www.learncpp.com/cpp-tutorial/93-overloading-the-io-operators/
     friend QTextStream & operator<< (QTextStream & o, State const & state);
@@ -207,10 +338,15 @@ public:
 
 public:
     bool hopefullyCurrentThreadIsRun (codeplace const & cp) const {
+#if THINKERQT_NO_CHECKS
+        Q_UNUSED(cp);
+        return true;
+#else
         return hopefully(
             QThread::currentThread() == _runner.getThinker().thread(),
             cp
         );
+#endif
     }
 
 
@@ -236,7 +372,12 @@ public slots:
 class ThinkerRunnerProxy : public QRunnable {
 
 public:
-    ThinkerRunnerProxy (shared_ptr<ThinkerRunner> runner);
+    // The first proxy for a runner adds it to the manager's thinker map.
+    // One made to requeue a parked runner finds it there already.
+    ThinkerRunnerProxy (
+        shared_ptr<ThinkerRunner> runner,
+        bool isRequeue = false
+    );
 
     ~ThinkerRunnerProxy () override;
 
@@ -0,0 +1,124 @@
+//
+// thinkertrace.h
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#ifndef THINKERQT_THINKERTRACE_H
+#define THINKERQT_THINKERTRACE_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+
+#include "defs.h"
+
+//
+// ThinkerTrace
+//
+// An optional timeline of what the thinkers and their threads were doing,
+// for when things go slow under load and averages (see ThinkerMetrics)
+// don't say why.  Once enabled, the library records:
+//
+// * runner state transitions, on a track per thinker labeled with its
+//   objectName() (or class name if it has none)
+// * lockForWrite()/unlock() spans
+// * snapshot creations
+// * throttled signal emits
+// * thread pushes done by the manager
+//
+// Each thread records into its own fixed-size ring buffer, and the oldest
+// events are overwritten once it is full.  Recording takes no locks.
+// Nothing is recorded while tracing is disabled, which it is by default,
+// beyond a test of one atomic flag.
+//
+// chromeTraceJson() gives the events in Chrome's trace-event format, which
+// Perfetto (https://ui.perfetto.dev) and chrome://tracing can open.
+// Threads are named after their QThread objectName() when their buffer is
+// made.
+//
+
+class ThinkerTrace
+{
+public:
+    static void setEnabled (bool enabled);
+
+    static bool isEnabled () {
+        return _enabled.loadAcquire() != 0;
+    }
+
+
+public:
+    // Spans and instants on the current thread's track.  Names must outlive
+    // the trace (string literals, in practice), as only the pointer is kept.
+
+    static void beginSpan (char const * name) {
+        if (isEnabled())
+            record('B', name, 0);
+    }
+
+    static void endSpan (char const * name) {
+        if (isEnabled())
+            record('E', name, 0);
+    }
+
+    static void instant (char const * name) {
+        if (isEnabled())
+            record('i', name, 0);
+    }
+
+
+public:
+    // Tracks that aren't tied to a thread, such as one per thinker.  Spans
+    // on a track may begin and end on different threads.  A null name
+    // stands for the track's own label, so a span covering the whole life
+    // of the thing being tracked shows its label.
+
+    static quint64 newTrack (QString const & label);
+
+    static void beginOnTrack (quint64 track, char const * name) {
+        if (isEnabled())
+            record('b', name, track);
+    }
+
+    static void endOnTrack (quint64 track, char const * name) {
+        if (isEnabled())
+            record('e', name, track);
+    }
+
+
+public:
+    // Events are copied out without stopping the threads recording them.
+    // Any a thread overwrites during the copy are left out.
+
+    static QByteArray chromeTraceJson ();
+
+    static bool saveChromeTrace (QString const & fileName);
+
+    // Only while no thread is recording (e.g. with tracing disabled and the
+    // thinkers quiet), as the buffers are reset without synchronization
+    static void clear ();
+
+
+private:
+    static void record (char phase, char const * name, quint64 track);
+
+    static QAtomicInt _enabled;
+};
+
+#endif
@@ -20,6 +20,8 @@
 //
 
 #include "thinkerqt/signalthrottler.h"
+#include "thinkerqt/thinkertrace.h"
+#include "thinkerqt/thinkerprobes.h"
 
 
 SignalThrottler::SignalThrottler (
@@ -70,6 +72,8 @@ void SignalThrottler::setMillisecondsDefault (int milliseconds) {
 void SignalThrottler::onTimeout() {
     QTime emitTime = QTime::currentTime();
 
+    ThinkerTrace::instant("throttled emit");
+    THINKERQT_PROBE(throttled_emit, this);
     emit throttled(); // likely queued, but could be direct... :-/
 
     enterThreadCheck();
@@ -125,8 +129,11 @@ void SignalThrottler::onReschedule() {
 
     exitThreadCheck();
 
-    if (shouldEmit)
+    if (shouldEmit) {
+        ThinkerTrace::instant("throttled emit");
+        THINKERQT_PROBE(throttled_emit, this);
         emit throttled();
+    }
 }
 
 
@@ -20,25 +20,38 @@
 //
 
 #include "thinkerqt/snapshottable.h"
+#include "thinkerqt/thinkertrace.h"
+#include "thinkerqt/thinkerprobes.h"
 
 // SnapshottableBase
 
 SnapshottableBase::SnapshottableBase () :
-    _dLock (),
-    _lockedForWrite (false, HERE)
+    _dLock (ThinkerLockProfile::Site::SnapshottableData),
+    _lockedForWrite (false, HERE),
+    _version (0),
+    _bytesDetached (0),
+    _memory (make_shared<SnapshotMemoryCounters>())
 {
 }
 
 
 void SnapshottableBase::lockForWrite (codeplace const & cp) {
     _lockedForWrite.hopefullyTransition(false, true, cp);
+
+    // The span includes waiting for snapshots in progress to let go
+    ThinkerTrace::beginSpan("write");
+    THINKERQT_PROBE(write_lock, this);
     _dLock.lockForWrite();
+    THINKERQT_PROBE(write_locked, this);
 }
 
 
 void SnapshottableBase::unlock (codeplace const & cp) {
     _lockedForWrite.hopefullyTransition(true, false, cp);
+    _version.fetchAndAddOrdered(1);
     _dLock.unlock();
+    THINKERQT_PROBE(write_unlock, this);
+    ThinkerTrace::endSpan("write");
 }
 
 
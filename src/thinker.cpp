@@ -19,10 +19,57 @@
 // See http://hostilefork.com/thinker-qt/ for more information on this project
 //
 
+#include <QElapsedTimer>
+#include <climits>
+
 #include "thinkerqt/thinker.h"
 #include "thinkerqt/thinkermanager.h"
 #include "thinkerqt/thinkerrunner.h"
 
+//
+// ThinkerBase::UpstreamListener
+//
+
+class ThinkerBase::UpstreamListener : public ThinkerListener
+{
+public:
+    UpstreamListener (
+        ThinkerBase & downstream,
+        shared_ptr<ThinkerRunner> runner
+    ) :
+        _downstream (downstream),
+        _runner (runner)
+    {
+    }
+
+public:
+    void thinkerWritten () override {
+        nudge();
+    }
+
+    void thinkerRetired (bool wasCanceled) override {
+        Q_UNUSED(wasCanceled);
+
+        _downstream._upstreamsRetired.fetchAndAddOrdered(1);
+        nudge();
+    }
+
+private:
+    void nudge () {
+        // The downstream's runner may be gone if it finished or was canceled
+        // while its upstreams kept going
+        shared_ptr<ThinkerRunner> runner = _runner.lock();
+        if (runner)
+            runner->nudge();
+    }
+
+private:
+    ThinkerBase & _downstream;
+    std::weak_ptr<ThinkerRunner> _runner;
+};
+
+
+
 //
 // Thinker
 //
@@ -31,17 +78,91 @@
 ThinkerBase::ThinkerBase (ThinkerManager & mgr) :
     QObject (),
     _state (State::ThinkerOwnedByRunner),
-    _mgr (mgr)
+    _status (0),
+    _mgr (mgr),
+    _listenersMutex (ThinkerLockProfile::Site::ThinkerListeners),
+    _listeners (nullptr),
+    _listenersGeneration (0),
+    _listenersReaders (),
+    _listenersRetired (false),
+    _retiredCallbacks (),
+    _lastRetiredToken (0),
+    _retired (0),
+    _inputs (),
+    _cacheKey (),
+    _upstreams (),
+    _upstreamVersionsSeen (),
+    _upstreamListener (),
+    _upstreamsRetired (0),
+    _versionWaiters (0),
+    _versionMutex (ThinkerLockProfile::Site::ThinkerVersion),
+    _versionWasPublished (),
+    _versionsRetired (false),
+    _activeWatchers (0),
+    _autoPauseWhenUnwatched (false),
+    _demandGeneration (0),
+    _presentCount (0),
+    _sharers (1),
+    _progressMinimum (0),
+    _progressMaximum (0),
+    _progressValue (0),
+    _progressTextMutex (),
+    _progressText (),
+    _results (nullptr),
+    _inbox (nullptr),
+    _waitingForMessages (0),
+    _metricsMutex (),
+    _metrics ()
 {
     getManager().hopefullyCurrentThreadIsManager(HERE);
+
+    // Nothing has been written yet, so nothing can have been pinned
+    _memory->total = getManager()._snapshotMemory;
 }
 #else
 ThinkerBase::ThinkerBase () :
     QObject (),
-    state (ThinkerOwnedByRunner),
-    mgr (ThinkerManager::getGlobalManager())
+    _state (State::ThinkerOwnedByRunner),
+    _status (0),
+    _mgr (ThinkerManager::getGlobalManager()),
+    _listenersMutex (ThinkerLockProfile::Site::ThinkerListeners),
+    _listeners (nullptr),
+    _listenersGeneration (0),
+    _listenersReaders (),
+    _listenersRetired (false),
+    _retiredCallbacks (),
+    _lastRetiredToken (0),
+    _retired (0),
+    _inputs (),
+    _cacheKey (),
+    _upstreams (),
+    _upstreamVersionsSeen (),
+    _upstreamListener (),
+    _upstreamsRetired (0),
+    _versionWaiters (0),
+    _versionMutex (ThinkerLockProfile::Site::ThinkerVersion),
+    _versionWasPublished (),
+    _versionsRetired (false),
+    _activeWatchers (0),
+    _autoPauseWhenUnwatched (false),
+    _demandGeneration (0),
+    _presentCount (0),
+    _sharers (1),
+    _progressMinimum (0),
+    _progressMaximum (0),
+    _progressValue (0),
+    _progressTextMutex (),
+    _progressText (),
+    _results (nullptr),
+    _inbox (nullptr),
+    _waitingForMessages (0),
+    _metricsMutex (),
+    _metrics ()
 {
     getManager().hopefullyCurrentThreadIsManager(HERE);
+
+    // Nothing has been written yet, so nothing can have been pinned
+    _memory->total = getManager()._snapshotMemory;
 }
 #endif
 
@@ -69,15 +190,381 @@ void ThinkerBase::lockForWrite (codeplace const & cp) {
 void ThinkerBase::unlock (codeplace const & cp) {
     hopefullyCurrentThreadIsThink(HERE);
 
+    // Release the data lock before notifying anyone.  A watcher woken up by
+    // the notification is going to want a snapshot, and it would just block
+    // on _dLock if we were still holding it.
+    SnapshottableBase::unlock(cp);
+
+    publishVersion();
+
     getManager().unlockThinker(*this);
+}
 
-    SnapshottableBase::unlock(cp);
+
+bool ThinkerBase::waitForVersionAfter (
+    quint64 version,
+    unsigned long time
+) {
+    // Registering as a waiter is ordered before we look at the version, and
+    // the publisher bumps the version before it looks for waiters.  So either
+    // we see the new version here or the publisher sees us and wakes us.
+    _versionWaiters.ref();
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    ThinkerMutexLocker lock (&_versionMutex);
+
+    bool result = (this->version() > version);
+    while (not result and not _versionsRetired) {
+        unsigned long remaining = ULONG_MAX;
+        if (time != ULONG_MAX) {
+            qint64 spent = elapsed.elapsed();
+            if (spent >= static_cast<qint64>(time))
+                break;
+            remaining = time - static_cast<unsigned long>(spent);
+        }
+
+        _versionMutex.waitOn(_versionWasPublished, remaining);
+        result = (this->version() > version);
+    }
+
+    lock.unlock();
+    _versionWaiters.deref();
+
+    return result;
+}
+
+
+void ThinkerBase::publishVersion () {
+    if (_versionWaiters.loadAcquire() == 0)
+        return;
+
+    ThinkerMutexLocker lock (&_versionMutex);
+    _versionWasPublished.wakeAll();
+}
+
+
+void ThinkerBase::retire (bool wasCanceled) {
+    // No more versions are coming, so release everyone who is waiting
+    {
+        ThinkerMutexLocker lock (&_versionMutex);
+        _versionsRetired = true;
+        _versionWasPublished.wakeAll();
+    }
+
+    // Setting the flag and loading the list under the same lock means a
+    // listener attaching from here on gets its retirement call from
+    // attachListener(), and only those that attached before are in the list
+    // we walk.  We enter as a reader before unlocking, so the list can't be
+    // freed out from under us in between.
+    QMap<quint64, std::function<void (bool)>> callbacks;
+    ListenerList const * listeners;
+    int generation;
+    {
+        ThinkerMutexLocker lock (&_listenersMutex);
+        hopefully(not _listenersRetired, HERE);
+        _listenersRetired = true;
+        callbacks.swap(_retiredCallbacks);
+        _retired.storeRelease(1);
+
+        generation = enterListeners();
+        listeners = _listeners.loadAcquire();
+    }
+
+    if (listeners) {
+        for (ThinkerListener * listener : *listeners)
+            listener->thinkerRetired(wasCanceled);
+    }
+
+    leaveListeners(generation);
+
+    // Tokens only go up, so these run in the order they were added
+    for (std::function<void (bool)> & callback : callbacks)
+        callback(wasCanceled);
+}
+
+
+void ThinkerBase::setFinishedFromCache (SnapshotBase const & snapshot) {
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+    hopefully(_state == State::ThinkerOwnedByRunner, HERE);
+
+    adoptSnapshotBase(snapshot);
+
+    _state = State::ThinkerFinished;
+    _status.storeRelease(StatusFinished);
+    retire(false);
+}
+
+
+quint64 ThinkerBase::whenRetired (std::function<void (bool)> callback) {
+    ThinkerMutexLocker lock (&_listenersMutex);
+
+    if (not _listenersRetired) {
+        quint64 token = ++_lastRetiredToken;
+        _retiredCallbacks.insert(token, callback);
+        return token;
+    }
+
+    lock.unlock();
+    callback(_state == State::ThinkerCanceled);
+    return 0;
+}
+
+
+void ThinkerBase::removeRetiredCallback (quint64 token) {
+    if (token == 0)
+        return;
+
+    ThinkerMutexLocker lock (&_listenersMutex);
+    _retiredCallbacks.remove(token);
+}
+
+
+void ThinkerBase::attachListener (ThinkerListener & listener) {
+    ThinkerMutexLocker lock (&_listenersMutex);
+
+    ListenerList const * oldListeners = _listeners.loadAcquire();
+    ListenerList * newListeners = oldListeners
+        ? new ListenerList (*oldListeners)
+        : new ListenerList ();
+
+    hopefully(not newListeners->contains(&listener), HERE);
+    newListeners->append(&listener);
+
+    replaceListeners(newListeners);
+
+    bool alreadyRetired = _listenersRetired;
+    lock.unlock();
+
+    if (alreadyRetired)
+        listener.thinkerRetired(_state == State::ThinkerCanceled);
+}
+
+
+void ThinkerBase::detachListener (ThinkerListener & listener) {
+    ThinkerMutexLocker lock (&_listenersMutex);
+
+    ListenerList const * oldListeners = _listeners.loadAcquire();
+    hopefully(oldListeners != nullptr, HERE);
+
+    ListenerList * newListeners = new ListenerList (*oldListeners);
+    bool removed = newListeners->removeOne(&listener);
+    hopefully(removed, HERE);
+
+    if (newListeners->isEmpty()) {
+        delete newListeners;
+        newListeners = nullptr;
+    }
+
+    replaceListeners(newListeners);
+}
+
+
+void ThinkerBase::replaceListeners (ListenerList const * newListeners) {
+    // Caller must hold _listenersMutex.  After the swap no new reader can
+    // pick up the old list, but one that loaded it already may still be
+    // walking it.  Flipping the generation sends new readers to the other
+    // counter, so the one we wait on only goes down: a thinker that keeps
+    // publishing can't hold us here.  Those reads are short (listeners may
+    // not block) so we just yield until they are done.
+
+    ListenerList const * oldListeners
+        = _listeners.fetchAndStoreOrdered(newListeners);
+
+    int oldGeneration = _listenersGeneration.loadAcquire();
+    _listenersGeneration.fetchAndStoreOrdered(1 - oldGeneration);
+
+    while (_listenersReaders[oldGeneration].loadAcquire() != 0)
+        QThread::yieldCurrentThread();
+
+    delete oldListeners;
+}
+
+
+int ThinkerBase::enterListeners () {
+    // A reader counts itself in the current generation *before* loading the
+    // list (ref() is ordered, so the load can't be hoisted above it).  If
+    // the generation flipped in between, a writer may already be waiting on
+    // the old counter without knowing about us, so we move over and retry.
+    while (true) {
+        int generation = _listenersGeneration.loadAcquire();
+        _listenersReaders[generation].ref();
+        if (_listenersGeneration.loadAcquire() == generation)
+            return generation;
+        _listenersReaders[generation].deref();
+    }
+}
+
+
+void ThinkerBase::leaveListeners (int generation) {
+    _listenersReaders[generation].deref();
+}
+
+
+void ThinkerBase::notifyListenersWritten () {
+    // We register as a reader before loading the list, so that a listener
+    // detaching on another thread won't free the array out from under us
+    int generation = enterListeners();
+
+    ListenerList const * listeners = _listeners.loadAcquire();
+    if (listeners) {
+        for (ThinkerListener * listener : *listeners)
+            listener->thinkerWritten();
+    }
+
+    leaveListeners(generation);
+}
+
+
+void ThinkerBase::setProgressRange (int minimum, int maximum) {
+    hopefullyCurrentThreadIsThink(HERE);
+    hopefully(minimum <= maximum, HERE);
+
+    // A reader may briefly see the new minimum with the old maximum, which
+    // QFuture's progress has the same tolerance for
+    _progressMinimum.storeRelease(minimum);
+    _progressMaximum.storeRelease(maximum);
+
+    notifyListenersProgressed();
+}
+
+
+void ThinkerBase::setProgressValue (int value) {
+    hopefullyCurrentThreadIsThink(HERE);
+
+    // Tight loops tend to report the same value over and over
+    if (_progressValue.fetchAndStoreOrdered(value) == value)
+        return;
+
+    notifyListenersProgressed();
+}
+
+
+void ThinkerBase::setProgressValueAndText (int value, QString const & text) {
+    hopefullyCurrentThreadIsThink(HERE);
+
+    QMutexLocker lock (&_progressTextMutex);
+    _progressText = text;
+    lock.unlock();
+
+    _progressValue.storeRelease(value);
+
+    notifyListenersProgressed();
+}
+
+
+void ThinkerBase::notifyListenersProgressed () {
+    // Same reader protocol as notifyListenersWritten()
+    int generation = enterListeners();
+
+    ListenerList const * listeners = _listeners.loadAcquire();
+    if (listeners) {
+        for (ThinkerListener * listener : *listeners)
+            listener->thinkerProgressed();
+    }
+
+    leaveListeners(generation);
+}
+
+
+void ThinkerBase::notifyListenersResultsReported () {
+    // Same reader protocol as notifyListenersWritten()
+    int generation = enterListeners();
+
+    ListenerList const * listeners = _listeners.loadAcquire();
+    if (listeners) {
+        for (ThinkerListener * listener : *listeners)
+            listener->thinkerResultsReported();
+    }
+
+    leaveListeners(generation);
+}
+
+
+bool ThinkerBase::hasMessages () const {
+    ThinkerInboxBase const * inbox = _inbox.loadAcquire();
+    return (inbox != nullptr) and (inbox->pendingCount() > 0);
+}
+
+
+bool ThinkerBase::hasReadyMessage () const {
+    ThinkerInboxBase const * inbox = _inbox.loadAcquire();
+    return (inbox != nullptr) and inbox->isReady();
+}
+
+
+int ThinkerBase::cacheCost () const {
+    qint64 bytes = memoryUsage().currentBytes;
+    return static_cast<int>(qMin<qint64>(bytes, INT_MAX));
+}
+
+
+void ThinkerBase::setAutoPauseWhenUnwatched (bool autoPause) {
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+    hopefully(_activeWatchers.loadAcquire() == 0, HERE);
+
+    _autoPauseWhenUnwatched = autoPause;
+}
+
+
+void ThinkerBase::watcherActivated () {
+    if (_activeWatchers.fetchAndAddOrdered(1) != 0)
+        return;
+
+    if (_autoPauseWhenUnwatched)
+        getManager().watcherDemandChanged(*this);
+}
+
+
+void ThinkerBase::watcherDeactivated () {
+    int oldCount = _activeWatchers.fetchAndAddOrdered(-1);
+    hopefully(oldCount > 0, HERE);
+
+    if (oldCount != 1)
+        return;
+
+    if (_autoPauseWhenUnwatched)
+        getManager().watcherDemandChanged(*this);
+}
+
+
+void ThinkerBase::presentAcquired () {
+    _presentCount.ref();
+}
+
+
+void ThinkerBase::presentReleased () {
+    if (not _presentCount.deref())
+        getManager().thinkerOrphaned(*this);
+}
+
+
+bool ThinkerBase::tryJoinSharers () {
+    int sharers = _sharers.loadAcquire();
+    while (sharers != 0) {
+        if (_sharers.testAndSetOrdered(sharers, sharers + 1))
+            return true;
+        sharers = _sharers.loadAcquire();
+    }
+    return false;
+}
+
+
+bool ThinkerBase::leaveSharers () {
+    // true if we were the last one
+    return not _sharers.deref();
 }
 
 
 bool ThinkerBase::wasPauseRequested (unsigned long time) const {
     hopefullyCurrentThreadIsThink(HERE);
 
+    // Thinkers poll this constantly, so skip the map when we're running
+    ThinkerRunner * current = ThinkerRunner::currentMaybeNull();
+    if ((current != nullptr) and (&current->getThinker() == this))
+        return current->wasPauseRequested(time);
+
     auto runner = getManager().maybeGetRunnerForThinker(*this);
     if (runner == nullptr) {
         hopefully(_state == State::ThinkerFinished, HERE);
@@ -91,6 +578,12 @@ bool ThinkerBase::wasPauseRequested (unsigned long time) const {
 void ThinkerBase::pollForStopException (unsigned long time) const {
     hopefullyCurrentThreadIsThink(HERE);
 
+    ThinkerRunner * current = ThinkerRunner::currentMaybeNull();
+    if ((current != nullptr) and (&current->getThinker() == this)) {
+        current->pollForStopException(time);
+        return;
+    }
+
     auto runner = getManager().maybeGetRunnerForThinker(*this);
     if (runner == nullptr) {
         hopefully(_state == State::ThinkerFinished, HERE);
@@ -101,7 +594,96 @@ void ThinkerBase::pollForStopException (unsigned long time) const {
 #endif
 
 
+void ThinkerBase::addUpstream (ThinkerPresentBase upstream) {
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+
+    hopefully(upstream != ThinkerPresentBase(), HERE);
+    hopefully(&upstream.getThinkerBase() != this, HERE);
+    hopefully(not _upstreams.contains(upstream), HERE);
+
+    // Listeners get attached once the thinker starts waiting
+    hopefully(_upstreamListener == nullptr, HERE);
+
+    _upstreams.append(upstream);
+
+    // Nothing matches this, so the first wait sees every upstream as written
+    _upstreamVersionsSeen.append(~quint64(0));
+}
+
+
+bool ThinkerBase::waitForUpstreamWritten (unsigned long time) {
+    hopefullyCurrentThreadIsThink(HERE);
+
+    // Only the thinker's own thread waits here, so it is the current runner
+    // and we don't need the manager's map (or its mutex) to find it
+    ThinkerRunner * runner = ThinkerRunner::currentMaybeNull();
+    hopefully(runner != nullptr, HERE);
+    hopefully(&runner->getThinker() == this, HERE);
+
+    if (_upstreamListener == nullptr) {
+        _upstreamListener.reset(
+            new UpstreamListener (*this, runner->shared_from_this())
+        );
+        for (ThinkerPresentBase & upstream : _upstreams)
+            upstream.getThinkerBase().attachListener(*_upstreamListener);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    while (not runner->wasPauseRequested()) {
+        // An upstream publishes its last version before it retires, so we
+        // must look at the retirements first to not miss that version
+        bool allRetired = (
+            _upstreamsRetired.loadAcquire() == _upstreams.size()
+        );
+
+        bool written = false;
+        for (int index = 0; index < _upstreams.size(); ++index) {
+            quint64 version = _upstreams[index].getThinkerBase().version();
+            if (version != _upstreamVersionsSeen[index]) {
+                _upstreamVersionsSeen[index] = version;
+                written = true;
+            }
+        }
+
+        if (written)
+            return true;
+
+        if (allRetired)
+            return false;
+
+        unsigned long remaining = ULONG_MAX;
+        if (time != ULONG_MAX) {
+            qint64 elapsed = timer.elapsed();
+            if (static_cast<unsigned long>(elapsed) >= time)
+                return false;
+            remaining = time - static_cast<unsigned long>(elapsed);
+        }
+
+        runner->waitForNudge(remaining);
+    }
+
+    return false;
+}
+
+
 ThinkerBase::~ThinkerBase () {
     getManager().hopefullyCurrentThreadIsManager(HERE);
     hopefully(getManager().maybeGetRunnerForThinker(*this) == nullptr, HERE);
+
+    getManager().forgetThinker(*this);
+
+    // Listeners hold a Present, and so they should all be gone by now
+    hopefully(_listeners.loadAcquire() == nullptr, HERE);
+
+    // Presents are all gone, so no cursor can be reading this
+    delete _results.loadAcquire();
+    delete _inbox.loadAcquire();
+
+    // Our upstreams are still alive, as we hold Presents to them
+    if (_upstreamListener != nullptr) {
+        for (ThinkerPresentBase & upstream : _upstreams)
+            upstream.getThinkerBase().detachListener(*_upstreamListener);
+    }
 }
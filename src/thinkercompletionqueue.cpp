@@ -0,0 +1,132 @@
+//
+// thinkercompletionqueue.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QList>
+
+#include "thinkerqt/thinkercompletionqueue.h"
+#include "thinkerqt/thinker.h"
+#include "thinkerqt/thinkermanager.h"
+
+
+//
+// ThinkerCompletionQueue::Retired
+//
+// What the retirement callbacks see.  The queue removes its callbacks when
+// it is destroyed, but one that a thinker's retirement has already taken may
+// still run after that.  So this may outlive the queue, and the entries
+// added then are never looked at.
+//
+
+class ThinkerCompletionQueue::Retired
+{
+public:
+    QMutex mutex;
+    QWaitCondition wasAppended;
+    QList<ThinkerBase const *> thinkers;
+};
+
+
+
+//
+// ThinkerCompletionQueue
+//
+
+ThinkerCompletionQueue::ThinkerCompletionQueue () :
+    _thread (QThread::currentThread()),
+    _mgr (nullptr),
+    _pending (),
+    _retired (make_shared<Retired>())
+{
+}
+
+
+void ThinkerCompletionQueue::addPresent (ThinkerPresentBase present) {
+    hopefully(QThread::currentThread() == _thread, HERE);
+    hopefully(present != ThinkerPresentBase(), HERE);
+
+    ThinkerBase & thinker = present.getThinkerBase();
+    hopefully(not _pending.contains(&thinker), HERE);
+
+    if (_mgr == nullptr)
+        _mgr = &thinker.getManager();
+    else
+        hopefully(_mgr == &thinker.getManager(), HERE);
+
+    Pending & pending = _pending[&thinker];
+    pending.present = present;
+
+    // Runs right here if the thinker already retired
+    shared_ptr<Retired> retired = _retired;
+    ThinkerBase const * key = &thinker;
+    pending.token = thinker.whenRetired([retired, key] (bool wasCanceled) {
+        Q_UNUSED(wasCanceled);
+
+        QMutexLocker lock (&retired->mutex);
+        retired->thinkers.append(key);
+        retired->wasAppended.wakeOne();
+    });
+}
+
+
+ThinkerPresentBase ThinkerCompletionQueue::takeRetired (unsigned long time) {
+    hopefully(QThread::currentThread() == _thread, HERE);
+
+    if (_pending.isEmpty())
+        return ThinkerPresentBase ();
+
+    _mgr->hopefullyCurrentThreadIsNotManager(HERE);
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    QMutexLocker lock (&_retired->mutex);
+
+    while (_retired->thinkers.isEmpty()) {
+        unsigned long remaining = ULONG_MAX;
+        if (time != ULONG_MAX) {
+            qint64 spent = elapsed.elapsed();
+            if (spent >= static_cast<qint64>(time))
+                return ThinkerPresentBase ();
+            remaining = time - static_cast<unsigned long>(spent);
+        }
+
+        _retired->wasAppended.wait(&_retired->mutex, remaining);
+    }
+
+    ThinkerBase const * thinker = _retired->thinkers.takeFirst();
+    lock.unlock();
+
+    hopefully(_pending.contains(thinker), HERE);
+    return _pending.take(thinker).present;
+}
+
+
+ThinkerCompletionQueue::~ThinkerCompletionQueue () {
+    hopefully(QThread::currentThread() == _thread, HERE);
+
+    // Our Presents keep the thinkers alive until their callbacks are gone
+    for (Pending & pending : _pending)
+        pending.present.getThinkerBase().removeRetiredCallback(pending.token);
+}
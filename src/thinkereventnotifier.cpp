@@ -0,0 +1,134 @@
+//
+// thinkereventnotifier.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include "thinkerqt/thinkereventnotifier.h"
+
+#ifdef Q_OS_LINUX
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include "thinkerqt/thinker.h"
+
+//
+// ThinkerEventNotifier
+//
+
+ThinkerEventNotifier::ThinkerEventNotifier () :
+    _fd (::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    _signaled (0),
+    _presents ()
+{
+    hopefully(_fd != -1, HERE);
+}
+
+
+ThinkerEventNotifier::ThinkerEventNotifier (ThinkerPresentBase present) :
+    ThinkerEventNotifier ()
+{
+    addPresent(present);
+}
+
+
+void ThinkerEventNotifier::addPresent (ThinkerPresentBase present) {
+    present.hopefullyCurrentThreadIsDifferent(HERE);
+
+    // A default-constructed Present has no thinker to listen to
+    if (present == ThinkerPresentBase())
+        return;
+
+    hopefully(not _presents.contains(present), HERE);
+    _presents.append(present);
+
+    // If the thinker already retired this will signal right away
+    present.getThinkerBase().attachListener(*this);
+}
+
+
+void ThinkerEventNotifier::removePresent (ThinkerPresentBase present) {
+    present.hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (present == ThinkerPresentBase())
+        return;
+
+    bool removed = _presents.removeOne(present);
+    hopefully(removed, HERE);
+    present.getThinkerBase().detachListener(*this);
+}
+
+
+bool ThinkerEventNotifier::acknowledge () {
+    // Read before clearing the flag.  A publish that lands in between sees
+    // the flag still set and skips its write, but we haven't looked at the
+    // Presents yet so we will see its data anyway.  The worst case is the
+    // other interleaving, which leaves a spurious wakeup behind.
+    quint64 count = 0;
+    ssize_t result;
+    do {
+        result = ::read(_fd, &count, sizeof(count));
+    } while ((result == -1) and (errno == EINTR));
+
+    hopefully(
+        (result == sizeof(count)) or ((result == -1) and (errno == EAGAIN)),
+        HERE
+    );
+
+    _signaled.fetchAndStoreOrdered(0);
+
+    return result == sizeof(count);
+}
+
+
+void ThinkerEventNotifier::signal () {
+    if (not _signaled.testAndSetOrdered(0, 1))
+        return;
+
+    quint64 one = 1;
+    ssize_t result;
+    do {
+        result = ::write(_fd, &one, sizeof(one));
+    } while ((result == -1) and (errno == EINTR));
+
+    hopefully(result == sizeof(one), HERE);
+}
+
+
+void ThinkerEventNotifier::thinkerWritten () {
+    signal();
+}
+
+
+void ThinkerEventNotifier::thinkerRetired (bool wasCanceled) {
+    Q_UNUSED(wasCanceled);
+    signal();
+}
+
+
+ThinkerEventNotifier::~ThinkerEventNotifier () {
+    for (ThinkerPresentBase & present : _presents)
+        present.getThinkerBase().detachListener(*this);
+    _presents.clear();
+
+    ::close(_fd);
+}
+
+#endif
@@ -0,0 +1,155 @@
+//
+// thinkergraph.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+
+#include "thinkerqt/thinkergraph.h"
+#include "thinkerqt/thinkermanager.h"
+#include "thinkerqt/thinkerrunner.h"
+
+
+//
+// ThinkerGraph
+//
+
+ThinkerGraph::ThinkerGraph () :
+    _presents ()
+{
+}
+
+
+ThinkerManager & ThinkerGraph::getManager () const {
+    hopefully(not _presents.isEmpty(), HERE);
+
+    return _presents.first().getThinkerBase().getManager();
+}
+
+
+void ThinkerGraph::addPresent (ThinkerPresentBase present) {
+    hopefully(present != ThinkerPresentBase(), HERE);
+    hopefully(not _presents.contains(present), HERE);
+
+    _presents.append(present);
+
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+}
+
+
+QVector<shared_ptr<ThinkerRunner>> ThinkerGraph::getRunners () const {
+    QVector<shared_ptr<ThinkerRunner>> result;
+
+    // Stages that already finished or were canceled have no runner
+    for (ThinkerPresentBase const & present : _presents) {
+        ThinkerBase const & thinker = present.getThinkerBase();
+        auto runner = getManager().maybeGetRunnerForThinker(thinker);
+        if (runner != nullptr)
+            result.append(runner);
+    }
+
+    return result;
+}
+
+
+void ThinkerGraph::pause () {
+    if (_presents.isEmpty())
+        return;
+
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+
+    auto runners = getRunners();
+
+    for (auto & runner : runners)
+        runner->requestPauseButPausedOrCanceledIsOkay(HERE);
+
+    for (auto & runner : runners)
+        runner->waitForPauseButCanceledIsOkay();
+}
+
+
+void ThinkerGraph::resume () {
+    if (_presents.isEmpty())
+        return;
+
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+
+    for (auto & runner : getRunners()) {
+        if (runner->isPaused())
+            runner->requestResumeButCanceledIsOkay(HERE);
+    }
+}
+
+
+void ThinkerGraph::cancel () {
+    if (_presents.isEmpty())
+        return;
+
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+
+    // As with ThinkerPresent::cancel(), we don't wait for the stages to get
+    // off the stack.  Downstream stages blocked in waitForUpstreamWritten()
+    // are woken by the request itself.
+    for (ThinkerPresentBase & present : _presents)
+        present.cancel();
+}
+
+
+void ThinkerGraph::waitForFinished () {
+    if (_presents.isEmpty())
+        return;
+
+    getManager().hopefullyCurrentThreadIsManager(HERE);
+
+    // Upstreams are usually added first, and they have to finish before the
+    // stages reading them can, so this order tends to not wait twice
+    for (ThinkerPresentBase & present : _presents)
+        present.waitForFinished();
+}
+
+
+bool ThinkerGraph::isFinished () const {
+    for (ThinkerPresentBase const & present : _presents) {
+        if (not present.isFinished())
+            return false;
+    }
+    return true;
+}
+
+
+bool ThinkerGraph::isCanceled () const {
+    for (ThinkerPresentBase const & present : _presents) {
+        if (present.isCanceled())
+            return true;
+    }
+    return false;
+}
+
+
+bool ThinkerGraph::isPaused () const {
+    for (ThinkerPresentBase const & present : _presents) {
+        if (present.isPaused())
+            return true;
+    }
+    return false;
+}
+
+
+ThinkerGraph::~ThinkerGraph () {
+    // Like a Present, dropping the graph doesn't cancel anything
+}
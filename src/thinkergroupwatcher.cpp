@@ -0,0 +1,234 @@
+//
+// thinkergroupwatcher.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QMutexLocker>
+
+#include "thinkerqt/thinkergroupwatcher.h"
+#include "thinkerqt/thinker.h"
+
+
+//
+// ThinkerGroupWatcher::Member
+//
+// One of these is attached as a listener to each thinker in the group.  The
+// flags record what happened since the last emit; whoever sets the first
+// flag is responsible for putting the member on the pending list.
+//
+
+class ThinkerGroupWatcher::Member : public ThinkerListener
+{
+public:
+    enum Flags {
+        Written = 0x1,
+        Finished = 0x2
+    };
+
+public:
+    Member (ThinkerGroupWatcher & group, ThinkerPresentBase present) :
+        _group (group),
+        _present (present),
+        _flags (0)
+    {
+    }
+
+    ~Member () override
+    {
+    }
+
+public:
+    void thinkerWritten () override {
+        raise(Written);
+    }
+
+    void thinkerRetired (bool wasCanceled) override {
+        // Being canceled is something the owner of the Present did, so it's
+        // not news to them.  The single-Present watcher doesn't report it
+        // either.
+        if (not wasCanceled)
+            raise(Finished);
+    }
+
+private:
+    void raise (int flag) {
+        if (_flags.fetchAndOrOrdered(flag) == 0)
+            _group.schedule(*this);
+    }
+
+public:
+    ThinkerGroupWatcher & _group;
+    ThinkerPresentBase _present;
+    QAtomicInt _flags;
+};
+
+
+
+//
+// ThinkerGroupWatcher
+//
+
+ThinkerGroupWatcher::ThinkerGroupWatcher (QObject * parent) :
+    QObject (parent),
+    _throttler (200),
+    _active (true),
+    _members (),
+    _pendingMutex (),
+    _pending ()
+{
+    connect(
+        &_throttler, &SignalThrottler::throttled,
+        this, &ThinkerGroupWatcher::onThrottled,
+        Qt::DirectConnection
+    );
+}
+
+
+void ThinkerGroupWatcher::setThrottleTime (unsigned int milliseconds) {
+    _throttler.setMillisecondsDefault(milliseconds);
+}
+
+
+void ThinkerGroupWatcher::addPresent (ThinkerPresentBase present) {
+    present.hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (present == ThinkerPresentBase())
+        return;
+
+    ThinkerBase & thinker = present.getThinkerBase();
+    hopefully(not _members.contains(&thinker), HERE);
+
+    Member * member = new Member (*this, present);
+    _members.insert(&thinker, member);
+
+    // If the thinker has already finished, this will queue a notification
+    // for it right away
+    thinker.attachListener(*member);
+
+    if (_active)
+        thinker.watcherActivated();
+}
+
+
+void ThinkerGroupWatcher::removePresent (ThinkerPresentBase present) {
+    present.hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (present == ThinkerPresentBase())
+        return;
+
+    ThinkerBase & thinker = present.getThinkerBase();
+    Member * member = _members.take(&thinker);
+    hopefully(member != nullptr, HERE);
+
+    if (_active)
+        thinker.watcherDeactivated();
+
+    // Once this returns the thinker is no longer inside any of the member's
+    // callbacks, so the only other reference can be in the pending list
+    thinker.detachListener(*member);
+
+    QMutexLocker lock (&_pendingMutex);
+    _pending.removeOne(member);
+    lock.unlock();
+
+    delete member;
+}
+
+
+bool ThinkerGroupWatcher::containsPresent (
+    ThinkerPresentBase const & present
+) const {
+    if (present == ThinkerPresentBase())
+        return false;
+
+    return _members.contains(&present.getThinkerBase());
+}
+
+
+QVector<ThinkerPresentBase> ThinkerGroupWatcher::presents () const {
+    QVector<ThinkerPresentBase> result;
+    result.reserve(_members.size());
+    for (Member * member : _members)
+        result.append(member->_present);
+    return result;
+}
+
+
+void ThinkerGroupWatcher::clear () {
+    for (ThinkerPresentBase & present : presents())
+        removePresent(present);
+}
+
+
+void ThinkerGroupWatcher::setActive (bool active) {
+    if (_active == active)
+        return;
+
+    _active = active;
+
+    for (Member * member : _members) {
+        ThinkerBase & thinker = member->_present.getThinkerBase();
+        if (active)
+            thinker.watcherActivated();
+        else
+            thinker.watcherDeactivated();
+    }
+}
+
+
+void ThinkerGroupWatcher::schedule (Member & member) {
+    // Called on thinker threads, but only once per member per emit
+    QMutexLocker lock (&_pendingMutex);
+    _pending.append(&member);
+    lock.unlock();
+
+    _throttler.emitThrottled();
+}
+
+
+void ThinkerGroupWatcher::onThrottled () {
+    QVector<Member *> pending;
+    QMutexLocker lock (&_pendingMutex);
+    pending.swap(_pending);
+    lock.unlock();
+
+    QVector<ThinkerPresentBase> written;
+    QVector<ThinkerPresentBase> finished;
+
+    for (Member * member : pending) {
+        // Clearing the flags re-arms the member; a write that comes in after
+        // this will schedule another emit.  Members can't be deleted out from
+        // under us because removal happens on this same thread.
+        int flags = member->_flags.fetchAndStoreOrdered(0);
+        if (flags & Member::Written)
+            written.append(member->_present);
+        if (flags & Member::Finished)
+            finished.append(member->_present);
+    }
+
+    if (written.isEmpty() and finished.isEmpty())
+        return;
+
+    emit changed(written, finished);
+}
+
+
+ThinkerGroupWatcher::~ThinkerGroupWatcher () {
+    clear();
+}
@@ -0,0 +1,292 @@
+//
+// thinkerlockprofile.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <algorithm>
+
+#include "thinkerqt/thinkerlockprofile.h"
+
+
+//
+// Per-site counters
+//
+// Every lock of a site counts into the same atomics, so no lock is taken
+// to record.  A report may catch one acquisition half counted.
+//
+
+namespace {
+
+struct SiteCounters {
+    QAtomicInteger<quint64> acquisitions;
+    QAtomicInteger<quint64> contended;
+    QAtomicInteger<qint64> waitNsecs;
+    QAtomicInteger<qint64> maxWaitNsecs;
+    QAtomicInteger<quint64> waitBuckets[LatencyHistogram::BucketCount];
+    QAtomicInteger<qint64> holdNsecs;
+    QAtomicInteger<qint64> maxHoldNsecs;
+};
+
+SiteCounters counters[ThinkerLockProfile::SiteCount];
+
+char const * const siteNames[ThinkerLockProfile::SiteCount] = {
+    "ThinkerManager::_mapsMutex",
+    "ThinkerManager::_pushThreadMutex",
+    "ThinkerManager::_demandMutex",
+    "ThinkerManager::_orphanMutex",
+    "ThinkerManager::_cacheMutex",
+    "ThinkerRunner::_stateMutex",
+    "SnapshottableBase::_dLock",
+    "ThinkerBase::_listenersMutex",
+    "ThinkerBase::_versionMutex"
+};
+
+// Started once while the program loads, and only read after that, so the
+// threads timing their locks never race with anyone writing it
+QElapsedTimer startedClock () {
+    QElapsedTimer clock;
+    clock.start();
+    return clock;
+}
+
+QElapsedTimer const profileClock = startedClock();
+
+SiteCounters & countersFor (ThinkerLockProfile::Site site) {
+    return counters[static_cast<int>(site)];
+}
+
+void storeMaximum (QAtomicInteger<qint64> & maximum, qint64 value) {
+    qint64 seen = maximum.loadAcquire();
+    while (value > seen) {
+        if (maximum.testAndSetOrdered(seen, value))
+            return;
+        seen = maximum.loadAcquire();
+    }
+}
+
+} // end anonymous namespace
+
+
+QAtomicInt ThinkerLockProfile::_enabled (0);
+
+
+void ThinkerLockProfile::setEnabled (bool enabled) {
+    _enabled.storeRelease(enabled ? 1 : 0);
+}
+
+
+qint64 ThinkerLockProfile::now () {
+    return profileClock.nsecsElapsed() + 1;
+}
+
+
+void ThinkerLockProfile::acquired (
+    Site site,
+    qint64 waitedNsecs,
+    bool contended
+) {
+    SiteCounters & siteCounters = countersFor(site);
+
+    siteCounters.acquisitions.fetchAndAddRelaxed(1);
+    siteCounters.waitBuckets[
+        LatencyHistogram::bucketIndex(waitedNsecs)
+    ].fetchAndAddRelaxed(1);
+
+    if (contended) {
+        siteCounters.contended.fetchAndAddRelaxed(1);
+        siteCounters.waitNsecs.fetchAndAddRelaxed(waitedNsecs);
+        storeMaximum(siteCounters.maxWaitNsecs, waitedNsecs);
+    }
+}
+
+
+void ThinkerLockProfile::released (Site site, qint64 heldNsecs) {
+    SiteCounters & siteCounters = countersFor(site);
+
+    siteCounters.holdNsecs.fetchAndAddRelaxed(heldNsecs);
+    storeMaximum(siteCounters.maxHoldNsecs, heldNsecs);
+}
+
+
+ThinkerLockStats ThinkerLockProfile::stats (Site site) {
+    SiteCounters & siteCounters = countersFor(site);
+
+    ThinkerLockStats result;
+    result.name = siteNames[static_cast<int>(site)];
+    result.acquisitions = siteCounters.acquisitions.loadAcquire();
+    result.contended = siteCounters.contended.loadAcquire();
+    result.waitNsecs = siteCounters.waitNsecs.loadAcquire();
+    result.holdNsecs = siteCounters.holdNsecs.loadAcquire();
+    result.maxHoldNsecs = siteCounters.maxHoldNsecs.loadAcquire();
+
+    quint64 buckets[LatencyHistogram::BucketCount];
+    for (int index = 0; index < LatencyHistogram::BucketCount; index++)
+        buckets[index] = siteCounters.waitBuckets[index].loadAcquire();
+    result.waitHistogram.add(
+        buckets, siteCounters.maxWaitNsecs.loadAcquire()
+    );
+
+    return result;
+}
+
+
+QVector<ThinkerLockStats> ThinkerLockProfile::report () {
+    QVector<ThinkerLockStats> result;
+    for (int index = 0; index < SiteCount; index++) {
+        ThinkerLockStats siteStats = stats(static_cast<Site>(index));
+        if (siteStats.acquisitions != 0)
+            result.append(siteStats);
+    }
+
+    std::sort(
+        result.begin(),
+        result.end(),
+        [] (ThinkerLockStats const & left, ThinkerLockStats const & right) {
+            return left.waitNsecs > right.waitNsecs;
+        }
+    );
+
+    return result;
+}
+
+
+QString ThinkerLockProfile::reportText () {
+    QString result;
+    QTextStream out (&result);
+
+    auto micros = [] (qint64 nsecs) {
+        return QString::number(nsecs / 1000.0, 'f', 1);
+    };
+
+    out << "Thinker-Qt lock profile (times in microseconds)\n";
+
+    for (ThinkerLockStats const & siteStats : report()) {
+        out << siteStats.name << ": "
+            << siteStats.acquisitions << " acquired, "
+            << siteStats.contended << " contended, "
+            << "wait total " << micros(siteStats.waitNsecs)
+            << " p99 " << micros(siteStats.waitHistogram.percentile(0.99))
+            << " max " << micros(siteStats.waitHistogram.maximum())
+            << ", hold total " << micros(siteStats.holdNsecs)
+            << " max " << micros(siteStats.maxHoldNsecs)
+            << "\n";
+    }
+
+    out.flush();
+    return result;
+}
+
+
+void ThinkerLockProfile::reset () {
+    for (SiteCounters & siteCounters : counters) {
+        siteCounters.acquisitions.storeRelease(0);
+        siteCounters.contended.storeRelease(0);
+        siteCounters.waitNsecs.storeRelease(0);
+        siteCounters.maxWaitNsecs.storeRelease(0);
+        for (auto & bucket : siteCounters.waitBuckets)
+            bucket.storeRelease(0);
+        siteCounters.holdNsecs.storeRelease(0);
+        siteCounters.maxHoldNsecs.storeRelease(0);
+    }
+}
+
+
+
+//
+// ThinkerMutex
+//
+
+void ThinkerMutex::lockProfiled () {
+    qint64 waited = 0;
+    bool contended = not QMutex::tryLock();
+    if (contended) {
+        qint64 start = ThinkerLockProfile::now();
+        QMutex::lock();
+        waited = ThinkerLockProfile::now() - start;
+    }
+
+    if (_depth++ == 0)
+        _heldSince = ThinkerLockProfile::now();
+
+    ThinkerLockProfile::acquired(_site, waited, contended);
+}
+
+
+void ThinkerMutex::releaseProfiled () {
+    ThinkerLockProfile::released(
+        _site, ThinkerLockProfile::now() - _heldSince
+    );
+    _heldSince = 0;
+}
+
+
+bool ThinkerMutex::waitOn (QWaitCondition & condition, unsigned long time) {
+    hopefully(_depth == 1, HERE);
+
+    // Others may take the mutex while we wait, and they keep these too
+    if (_heldSince != 0)
+        releaseProfiled();
+    _depth = 0;
+
+    bool woken = condition.wait(this, time);
+
+    _depth = 1;
+    _heldSince = ThinkerLockProfile::isEnabled()
+        ? ThinkerLockProfile::now()
+        : 0;
+
+    return woken;
+}
+
+
+
+//
+// ThinkerReadWriteLock
+//
+
+void ThinkerReadWriteLock::lockProfiled (bool forWrite) {
+    qint64 waited = 0;
+    bool contended = forWrite
+        ? not QReadWriteLock::tryLockForWrite()
+        : not QReadWriteLock::tryLockForRead();
+
+    if (contended) {
+        qint64 start = ThinkerLockProfile::now();
+        if (forWrite)
+            QReadWriteLock::lockForWrite();
+        else
+            QReadWriteLock::lockForRead();
+        waited = ThinkerLockProfile::now() - start;
+    }
+
+    if (forWrite)
+        _writeHeldSince = ThinkerLockProfile::now();
+
+    ThinkerLockProfile::acquired(_site, waited, contended);
+}
+
+
+void ThinkerReadWriteLock::releaseWriteProfiled () {
+    ThinkerLockProfile::released(
+        _site, ThinkerLockProfile::now() - _writeHeldSince
+    );
+    _writeHeldSince = 0;
+}
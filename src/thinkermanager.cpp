@@ -21,11 +21,259 @@
 
 #include <QThreadPool>
 #include <QMutexLocker>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QWaitCondition>
+#include <QDebug>
+#include <typeinfo>
+#include <algorithm>
 
 #include "thinkerqt/thinkerrunner.h"
 #include "thinkerqt/thinkermanager.h"
 
 
+//
+// ThinkerContinuation
+//
+// Bookkeeping for a thinker that is waiting on its inputs.  It is kept alive
+// by the retirement callbacks registered on those inputs, and hands the
+// runner to the thread pool from whichever thread delivers the retirement
+// that decides it.
+//
+
+class ThinkerContinuation
+{
+public:
+    ThinkerContinuation (
+        ThinkerRunnerProxy * proxy,
+        shared_ptr<ThinkerRunner> runner,
+        int inputCount,
+        bool needsAllInputs
+    ) :
+        _mutex (),
+        _proxy (proxy),
+        _runner (runner),
+        _snapshots (inputCount),
+        _remaining (inputCount),
+        _needsAllInputs (needsAllInputs),
+        _inputs (inputCount, nullptr),
+        _tokens (inputCount, 0),
+        _retired (inputCount, false)
+    {
+    }
+
+public:
+    // Called with the token from whenRetired() once the callback on an input
+    // is registered, so it can be removed if we launch without that input
+    void inputRegistered (int index, ThinkerBase & input, quint64 token) {
+        QMutexLocker lock (&_mutex);
+
+        if (_retired[index])
+            return;
+
+        if (_proxy == nullptr) {
+            input.removeRetiredCallback(token);
+            return;
+        }
+
+        _inputs[index] = &input;
+        _tokens[index] = token;
+    }
+
+    void inputRetired (int index, ThinkerBase & input, bool wasCanceled) {
+        // Take the snapshot before locking; the input is done writing
+        shared_ptr<SnapshotBase> snapshot;
+        if (not wasCanceled)
+            snapshot = shared_ptr<SnapshotBase> (input.createSnapshotBase());
+
+        QMutexLocker lock (&_mutex);
+
+        _retired[index] = true;
+        _inputs[index] = nullptr;
+
+        if (_proxy == nullptr)
+            return; // a whenAny() that already launched, or a cancel
+
+        _snapshots[index] = snapshot;
+        --_remaining;
+
+        bool launchNow;
+        if (wasCanceled)
+            launchNow = _needsAllInputs or (_remaining == 0);
+        else
+            launchNow = (not _needsAllInputs) or (_remaining == 0);
+
+        if (not launchNow)
+            return;
+
+        ThinkerRunnerProxy * proxy = _proxy;
+        _proxy = nullptr;
+        removeCallbacksLocked();
+
+        // The thinker isn't running yet, and handing the proxy to the pool
+        // publishes this write to whichever thread ends up running it
+        _runner->getThinker()._inputs = _snapshots;
+        lock.unlock();
+
+        if (wasCanceled)
+            _runner->cancelBeforeRun();
+
+        QThreadPool::globalInstance()->start(proxy);
+    }
+
+    // The runner has been (or is to be) canceled, so don't wait for the rest
+    // of the inputs; the pool lets it go without running it
+    void launchCanceled () {
+        QMutexLocker lock (&_mutex);
+
+        if (_proxy == nullptr)
+            return;
+
+        ThinkerRunnerProxy * proxy = _proxy;
+        _proxy = nullptr;
+        removeCallbacksLocked();
+        lock.unlock();
+
+        _runner->cancelBeforeRun();
+
+        QThreadPool::globalInstance()->start(proxy);
+    }
+
+private:
+    // Inputs that haven't retired would otherwise hold a dead callback each
+    // until they do.  This has to be done under the mutex: an input that
+    // retires can only go away after its call into inputRetired() returns.
+    void removeCallbacksLocked () {
+        for (int index = 0; index < _inputs.size(); ++index) {
+            if (_inputs[index] != nullptr)
+                _inputs[index]->removeRetiredCallback(_tokens[index]);
+            _inputs[index] = nullptr;
+        }
+    }
+
+private:
+    QMutex _mutex;
+    ThinkerRunnerProxy * _proxy; // pool owns it after launch
+    shared_ptr<ThinkerRunner> _runner;
+    QVector<shared_ptr<SnapshotBase>> _snapshots;
+    int _remaining;
+    bool _needsAllInputs;
+    QVector<ThinkerBase *> _inputs; // those with a callback still registered
+    QVector<quint64> _tokens;
+    QVector<bool> _retired;
+};
+
+
+
+//
+// ThinkerRetirementWait
+//
+// What the retirement callbacks registered by one waitForAny() or
+// waitForAll() call see, so a retirement only wakes the waits that are
+// looking at that thinker.  The callbacks are removed when the wait ends,
+// but one that a thinker's retirement has already taken may still run after
+// that, so this is shared with them.
+//
+
+class ThinkerRetirementWait
+{
+public:
+    ThinkerRetirementWait (int count) :
+        _thinkers (count, nullptr),
+        _tokens (count, 0),
+        _mutex (),
+        _wasRetired (),
+        _retiredCount (0),
+        _firstRetired (-1)
+    {
+    }
+
+public:
+    static shared_ptr<ThinkerRetirementWait> registerOn (
+        QVector<ThinkerPresentBase> const & presents
+    ) {
+        auto wait = make_shared<ThinkerRetirementWait>(presents.size());
+
+        // Runs right here for those already retired
+        for (int index = 0; index < presents.size(); ++index) {
+            if (presents[index] == ThinkerPresentBase())
+                continue;
+
+            // Registering doesn't change anything the caller can see
+            ThinkerBase & thinker = const_cast<ThinkerBase &>(
+                presents[index].getThinkerBase()
+            );
+            std::weak_ptr<ThinkerRetirementWait> weakWait = wait;
+            wait->_thinkers[index] = &thinker;
+            wait->_tokens[index] = thinker.whenRetired(
+                [weakWait, index] (bool wasCanceled) {
+                    Q_UNUSED(wasCanceled);
+
+                    shared_ptr<ThinkerRetirementWait> waiting
+                        = weakWait.lock();
+                    if (waiting)
+                        waiting->retired(index);
+                }
+            );
+        }
+        return wait;
+    }
+
+    ~ThinkerRetirementWait () {
+        // The caller's Presents keep the thinkers alive until we are done
+        for (int index = 0; index < _thinkers.size(); ++index) {
+            if (_thinkers[index] != nullptr)
+                _thinkers[index]->removeRetiredCallback(_tokens[index]);
+        }
+    }
+
+    // Returns false if the time (in milliseconds) ran out first
+    bool waitUntilRetired (int count, unsigned long time) {
+        QElapsedTimer elapsed;
+        elapsed.start();
+
+        QMutexLocker lock (&_mutex);
+
+        while (_retiredCount < count) {
+            unsigned long remaining = ULONG_MAX;
+            if (time != ULONG_MAX) {
+                qint64 spent = elapsed.elapsed();
+                if (spent >= static_cast<qint64>(time))
+                    return false;
+                remaining = time - static_cast<unsigned long>(spent);
+            }
+
+            _wasRetired.wait(&_mutex, remaining);
+        }
+        return true;
+    }
+
+    int firstRetired () {
+        QMutexLocker lock (&_mutex);
+        return _firstRetired;
+    }
+
+private:
+    void retired (int index) {
+        QMutexLocker lock (&_mutex);
+
+        if (_firstRetired == -1)
+            _firstRetired = index;
+        ++_retiredCount;
+        _wasRetired.wakeOne();
+    }
+
+private:
+    QVector<ThinkerBase *> _thinkers; // null for null Presents
+    QVector<quint64> _tokens;
+    QMutex _mutex;
+    QWaitCondition _wasRetired;
+    int _retiredCount;
+    int _firstRetired;
+};
+
+
+
 //
 // ThinkerManager
 //
@@ -53,7 +301,23 @@ ThinkerManager::ThinkerManager () :
     // mutex.  It may be desirable to have those assertions use a different
     // (and possibly faster) method for the test so we wouldn't have to
     // make this allow nested locks.
-    _mapsMutex (QMutex::Recursive)
+    _mapsMutex (ThinkerLockProfile::Site::ManagerMaps, QMutex::Recursive),
+    _pushThreadMutex (ThinkerLockProfile::Site::ManagerPushThread),
+
+    // A view being hidden and shown again in quick succession shouldn't
+    // pause its thinkers, so wait a little before deciding they're orphaned
+    _unwatchedGracePeriod (1000),
+    _demandMutex (ThinkerLockProfile::Site::ManagerDemand),
+    _cancelOrphans (0),
+    _orphanMutex (ThinkerLockProfile::Site::ManagerOrphan),
+    _resultCache (0),
+    _cachingResults (0),
+    _cacheMutex (ThinkerLockProfile::Site::ManagerCache),
+    _metricsEnabled (0),
+    _metricsMutex (),
+    _metricsTotals (),
+    _snapshotMemory (make_shared<SnapshotMemoryCounters>()),
+    _thinkers ()
 {
     hopefullyCurrentThreadIsManager(HERE);
 
@@ -68,9 +332,29 @@ ThinkerManager::ThinkerManager () :
         this, &ThinkerManager::doThreadPushesIfNecessary,
         Qt::QueuedConnection
     );
+
+    connect(
+        this, &ThinkerManager::demandCheckMayBeNeeded,
+        this, &ThinkerManager::doDemandChecks,
+        Qt::QueuedConnection
+    );
+
+    connect(
+        this, &ThinkerManager::cacheInsertMayBeNeeded,
+        this, &ThinkerManager::doCacheInserts,
+        Qt::QueuedConnection
+    );
+
+    connect(
+        this, &ThinkerManager::orphanCheckMayBeNeeded,
+        this, &ThinkerManager::doOrphanChecks,
+        Qt::QueuedConnection
+    );
 }
 
 
+#if not THINKERQT_NO_CHECKS
+
 bool ThinkerManager::hopefullyThreadIsManager (
     const QThread & thread,
     codeplace const & cp
@@ -113,7 +397,10 @@ bool ThinkerManager::hopefullyThreadIsNotThinker (
 bool ThinkerManager::hopefullyCurrentThreadIsNotThinker (
     codeplace const & cp
 ) {
-    return hopefullyThreadIsNotThinker(*QThread::currentThread(), cp);
+    ThinkerRunner * runner = ThinkerRunner::currentMaybeNull();
+    return hopefully(
+        (runner == nullptr) or (&runner->getManager() != this), cp
+    );
 }
 
 
@@ -128,9 +415,14 @@ bool ThinkerManager::hopefullyThreadIsThinker (
 bool ThinkerManager::hopefullyCurrentThreadIsThinker (
     codeplace const & cp
 ) {
-    return hopefullyThreadIsThinker(*QThread::currentThread(), cp);
+    ThinkerRunner * runner = ThinkerRunner::currentMaybeNull();
+    return hopefully(
+        (runner != nullptr) and (&runner->getManager() == this), cp
+    );
 }
 
+#endif
+
 
 void ThinkerManager::createRunnerForThinker (
     shared_ptr<ThinkerBase> holder,
@@ -139,6 +431,8 @@ void ThinkerManager::createRunnerForThinker (
     hopefullyCurrentThreadIsManager(cp);
     hopefully(holder != nullptr, cp);
 
+    trackThinker(holder);
+
     auto runner = make_shared<ThinkerRunner>(holder);
 
     ThinkerRunnerProxy * proxy = new ThinkerRunnerProxy (runner);
@@ -162,11 +456,105 @@ void ThinkerManager::createRunnerForThinker (
 }
 
 
+void ThinkerManager::createContinuationForThinker (
+    shared_ptr<ThinkerBase> holder,
+    QVector<ThinkerPresentBase> inputs,
+    bool needsAllInputs,
+    codeplace const & cp
+) {
+    hopefullyCurrentThreadIsManager(cp);
+    hopefully(holder != nullptr, cp);
+    hopefully(not inputs.isEmpty(), cp);
+
+    trackThinker(holder);
+
+    auto runner = make_shared<ThinkerRunner>(holder);
+
+    // The proxy puts the runner in the thinker map right away, so the
+    // continuation's Present can be paused, canceled or waited on while it
+    // waits for its inputs.  It just isn't given to the pool yet.
+    ThinkerRunnerProxy * proxy = new ThinkerRunnerProxy (runner);
+    proxy->setAutoDelete(true);
+
+    auto continuation = make_shared<ThinkerContinuation>(
+        proxy, runner, inputs.size(), needsAllInputs
+    );
+
+    // Weak, as the continuation holds the runner
+    std::weak_ptr<ThinkerContinuation> weakContinuation = continuation;
+    runner->setThinkerAdrift([weakContinuation] () {
+        shared_ptr<ThinkerContinuation> pending = weakContinuation.lock();
+        if (pending)
+            pending->launchCanceled();
+    });
+
+    for (int index = 0; index < inputs.size(); ++index) {
+        hopefully(inputs[index] != ThinkerPresentBase(), cp);
+
+        // The input can't go away before retiring, as its runner holds it,
+        // and an input that already retired calls back before this returns
+        ThinkerBase * input = &inputs[index].getThinkerBase();
+        quint64 token = input->whenRetired(
+            [continuation, index, input] (bool wasCanceled) {
+                continuation->inputRetired(index, *input, wasCanceled);
+            }
+        );
+        continuation->inputRegistered(index, *input, token);
+    }
+}
+
+
+int ThinkerManager::waitForAny (
+    QVector<ThinkerPresentBase> const & presents,
+    unsigned long time
+) {
+    hopefullyCurrentThreadIsNotManager(HERE);
+
+    // Null Presents count as canceled, following QFuture, and there's no
+    // need to register anything if one is done already
+    for (int index = 0; index < presents.size(); ++index) {
+        if (
+            (presents[index] == ThinkerPresentBase())
+            or presents[index].getThinkerBase().isRetired()
+        ) {
+            return index;
+        }
+    }
+
+    auto wait = ThinkerRetirementWait::registerOn(presents);
+    if (not wait->waitUntilRetired(1, time))
+        return -1;
+    return wait->firstRetired();
+}
+
+
+bool ThinkerManager::waitForAll (
+    QVector<ThinkerPresentBase> const & presents,
+    unsigned long time
+) {
+    hopefullyCurrentThreadIsNotManager(HERE);
+
+    // Null Presents count as canceled, following QFuture
+    int count = 0;
+    for (ThinkerPresentBase const & present : presents) {
+        if (present != ThinkerPresentBase())
+            ++count;
+    }
+
+    if (count == 0)
+        return true;
+
+    // Those that retired already call back as they are registered
+    auto wait = ThinkerRetirementWait::registerOn(presents);
+    return wait->waitUntilRetired(count, time);
+}
+
+
 void ThinkerManager::ensureThinkersPaused (codeplace const & cp) {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
     // we have to make a copy of the map
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
     auto mapCopy = _thinkerMap;
     lock.unlock();
 
@@ -191,7 +579,7 @@ void ThinkerManager::ensureThinkersPaused (codeplace const & cp) {
 void ThinkerManager::ensureThinkersResumed (codeplace const & cp) {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
 
     // any thinkers that have not been aborted can be resumed
 
@@ -202,10 +590,13 @@ void ThinkerManager::ensureThinkersResumed (codeplace const & cp) {
 }
 
 
+// Only needed when asking about some thread other than the current one;
+// see ThinkerRunner::currentMaybeNull()
+
 shared_ptr<ThinkerRunner> ThinkerManager::maybeGetRunnerForThread (
     const QThread & thread
 ) {
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
 
     shared_ptr<ThinkerRunner> result = _threadMap.value(&thread, nullptr);
 
@@ -218,7 +609,7 @@ shared_ptr<ThinkerRunner> ThinkerManager::maybeGetRunnerForThinker (
 ) {
     using State = ThinkerBase::State;
 
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
 
     shared_ptr<ThinkerRunner> result = _thinkerMap.value(&thinker, nullptr);
     if (not result) {
@@ -236,6 +627,13 @@ shared_ptr<ThinkerRunner> ThinkerManager::maybeGetRunnerForThinker (
 const ThinkerBase * ThinkerManager::getThinkerForThreadMaybeNull (
     const QThread & thread
 ) {
+    if (&thread == QThread::currentThread()) {
+        ThinkerRunner * current = ThinkerRunner::currentMaybeNull();
+        if ((current == nullptr) or (&current->getManager() != this))
+            return nullptr;
+        return &current->getThinker();
+    }
+
     shared_ptr<ThinkerRunner> runner = maybeGetRunnerForThread(thread);
     if (not runner)
         return nullptr;
@@ -251,7 +649,7 @@ void ThinkerManager::requestAndWaitForCancelButAlreadyCanceledIsOkay (
 
     shared_ptr<ThinkerRunner> runner = maybeGetRunnerForThinker(thinker);
     if (not runner) {
-        thinker._state = State::ThinkerCanceled;
+        thinker.setCanceledWithoutRunner();
     } else {
         // thread should be paused or finished... or possibly aborted
         runner->requestCancelButAlreadyCanceledIsOkay(HERE);
@@ -289,18 +687,343 @@ void ThinkerManager::ensureThinkerFinished (ThinkerBase & thinker) {
 
 
 void ThinkerManager::unlockThinker (ThinkerBase & thinker) {
-    // do throttled emit to all the ThinkerPresentWatchers
+    // do throttled emit to all the ThinkerPresentWatchers (and tell any other
+    // listeners).  This happens after the thinker has dropped its write lock.
+    thinker.notifyListenersWritten();
+
+    // there is a notification throttler for all thinkers.  Review: should it
+    // be possible to have a separate notification for groups?
+    _anyThinkerWrittenThrottler.emitThrottled();
+}
+
+
+void ThinkerManager::setUnwatchedGracePeriod (int milliseconds) {
+    hopefullyCurrentThreadIsManager(HERE);
+    hopefully(milliseconds >= 0, HERE);
+
+    _unwatchedGracePeriod = milliseconds;
+}
+
+
+void ThinkerManager::watcherDemandChanged (ThinkerBase & thinker) {
+    // May be called from any thread but the thinker's own.  If the thinker
+    // has already retired there is nothing to pause or resume.
+    shared_ptr<ThinkerRunner> runner = maybeGetRunnerForThinker(thinker);
+    if (not runner)
+        return;
+
+    ThinkerMutexLocker lock (&_demandMutex);
+    _runnersToCheckDemand.append(runner);
+    lock.unlock();
+
+    emit demandCheckMayBeNeeded();
+}
+
+
+void ThinkerManager::doDemandChecks () {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    QVector<shared_ptr<ThinkerRunner>> runners;
+    ThinkerMutexLocker lock (&_demandMutex);
+    runners.swap(_runnersToCheckDemand);
+    lock.unlock();
+
+    for (shared_ptr<ThinkerRunner> & runner : runners) {
+        ThinkerBase & thinker = runner->getThinker();
+
+        // Any pause that was scheduled before this change is now stale
+        int generation = ++thinker._demandGeneration;
+
+        if (thinker._activeWatchers.loadAcquire() == 0) {
+            QTimer::singleShot(_unwatchedGracePeriod, this,
+                [this, runner, generation] () {
+                    pauseIfStillUnwatched(runner, generation);
+                }
+            );
+        } else {
+            // Does nothing unless the pause is still ours
+            runner->requestAutoResume(HERE);
+        }
+    }
+}
+
+
+void ThinkerManager::pauseIfStillUnwatched (
+    shared_ptr<ThinkerRunner> runner,
+    int demandGeneration
+) {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    ThinkerBase & thinker = runner->getThinker();
+
+    if (demandGeneration != thinker._demandGeneration)
+        return; // demand changed again during the grace period
+
+    if (thinker._activeWatchers.loadAcquire() != 0)
+        return;
+
+    // Leaves it alone if the user paused it themselves, or it's done
+    runner->requestAutoPause(HERE);
+}
+
+
+void ThinkerManager::setCancelOrphanedThinkers (bool cancelOrphans) {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _cancelOrphans.storeRelease(cancelOrphans ? 1 : 0);
+}
+
+
+void ThinkerManager::thinkerOrphaned (ThinkerBase & thinker) {
+    if (_cancelOrphans.loadAcquire() == 0)
+        return;
+
+    // Already finished or canceled thinkers have nothing left to free
+    shared_ptr<ThinkerRunner> runner = maybeGetRunnerForThinker(thinker);
+    if (not runner)
+        return;
+
+    ThinkerMutexLocker lock (&_orphanMutex);
+    _runnersToCheckOrphaned.append(runner);
+    lock.unlock();
+
+    emit orphanCheckMayBeNeeded();
+}
+
+
+void ThinkerManager::doOrphanChecks () {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    QVector<shared_ptr<ThinkerRunner>> runners;
+    ThinkerMutexLocker lock (&_orphanMutex);
+    runners.swap(_runnersToCheckOrphaned);
+    lock.unlock();
+
+    for (shared_ptr<ThinkerRunner> & runner : runners) {
+        // A Present may have been handed out again since it was queued
+        if (runner->getThinker()._presentCount.loadAcquire() != 0)
+            continue;
+
+        runner->requestCancelButAlreadyCanceledIsOkay(HERE);
+    }
+
+    // Dropping our references lets the runners go as soon as their pool
+    // threads are done with them, which releases the thinkers as well
+}
+
+
+void ThinkerManager::setResultCacheBudget (int bytes) {
+    hopefullyCurrentThreadIsManager(HERE);
+    hopefully(bytes >= 0, HERE);
+
+    _resultCache.setMaxCost(bytes);
+    _cachingResults.storeRelease(bytes > 0 ? 1 : 0);
+}
+
+
+void ThinkerManager::clearResultCache () {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _resultCache.clear();
+}
+
+
+shared_ptr<ThinkerBase> ThinkerManager::maybeGetSharedThinker (
+    ThinkerBase & thinker
+) {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    QByteArray key = thinker.cacheKey();
+    if (key.isEmpty())
+        return nullptr;
+
+    // Thinkers of different types could easily come up with the same key
+    key.prepend('\0');
+    key.prepend(typeid(thinker).name());
+    thinker._cacheKey = key;
+
+    // Looking an entry up makes it the most recently used.  The thinker we
+    // were handed becomes the result, so it has a life of its own: canceling
+    // it does nothing, and nobody else's Presents are involved.
+    CachedResult * cached = _resultCache.object(key);
+    if (cached != nullptr) {
+        thinker.setFinishedFromCache(*cached->snapshot);
+        return nullptr;
+    }
+
+    shared_ptr<ThinkerBase> result;
     {
-        QReadLocker lock (&thinker._watchersLock);
+        ThinkerMutexLocker lock (&_mapsMutex);
+        shared_ptr<ThinkerRunner> runner = _inFlightMap.value(key, nullptr);
+
+        // Canceling happens when the last sharer leaves, and once that has
+        // happened joining is refused, so we can't end up sharing a thinker
+        // that is about to be canceled out from under us
+        if (
+            runner != nullptr
+            and not runner->isCanceled()
+            and runner->getThinker().tryJoinSharers()
+        ) {
+            result = runner->getHolder();
+        }
+    }
+
+    if (result) {
+        // The thinker we were handed will never run, so it can be destroyed
+        // like any canceled one
+        thinker.setCanceledWithoutRunner();
+    }
+
+    return result;
+}
+
+
+bool ThinkerManager::finishedFromCache (ThinkerBase const & thinker) {
+    // Nothing else finishes a thinker before it has been given a runner
+    return thinker._state == ThinkerBase::State::ThinkerFinished;
+}
+
+
+void ThinkerManager::doCacheInserts () {
+    using State = ThinkerBase::State;
 
-        for (ThinkerPresentWatcherBase * watcher : thinker._watchers) {
-            watcher->_notificationThrottler->emitThrottled();
+    hopefullyCurrentThreadIsManager(HERE);
+
+    QVector<shared_ptr<ThinkerRunner>> runners;
+    ThinkerMutexLocker lock (&_cacheMutex);
+    runners.swap(_runnersToCache);
+    lock.unlock();
+
+    // The budget may have gone to zero since these were queued
+    if (_resultCache.maxCost() == 0)
+        return;
+
+    for (shared_ptr<ThinkerRunner> & runner : runners) {
+        ThinkerBase & thinker = runner->getThinker();
+        hopefully(thinker._state == State::ThinkerFinished, HERE);
+
+        // Two runs of the same key may have been in flight at once; the one
+        // that finished first is as good as the other
+        if (_resultCache.contains(thinker._cacheKey))
+            continue;
+
+        // If the cost is more than the whole budget, QCache drops it
+        _resultCache.insert(
+            thinker._cacheKey,
+            new CachedResult {
+                shared_ptr<SnapshotBase> (thinker.createSnapshotBase())
+            },
+            thinker.cacheCost()
+        );
+    }
+}
+
+
+void ThinkerManager::setMetricsEnabled (bool enabled) {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _metricsEnabled.storeRelease(enabled ? 1 : 0);
+}
+
+
+ThinkerMetricsTotals ThinkerManager::metricsTotals () const {
+    QMutexLocker lock (&_metricsMutex);
+    return _metricsTotals;
+}
+
+
+void ThinkerManager::resetMetricsTotals () {
+    QMutexLocker lock (&_metricsMutex);
+    _metricsTotals = ThinkerMetricsTotals ();
+}
+
+
+SnapshottableMemoryUsage ThinkerManager::memoryUsage () {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    QVector<shared_ptr<ThinkerBase>> holders = lockTrackedThinkers();
+
+    SnapshottableMemoryUsage result;
+    for (shared_ptr<ThinkerBase> const & holder : holders) {
+        SnapshottableMemoryUsage usage = holder->memoryUsage();
+        result.currentBytes += usage.currentBytes;
+        result.bytesDetached += usage.bytesDetached;
+    }
+
+    result.pinnedVersions = _snapshotMemory->pinnedVersions.loadAcquire();
+    result.pinnedBytes = _snapshotMemory->pinnedBytes.loadAcquire();
+    return result;
+}
+
+
+QVector<ThinkerManager::MemoryHolder> ThinkerManager::largestMemoryHolders (
+    int count
+) {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    QVector<shared_ptr<ThinkerBase>> holders = lockTrackedThinkers();
+
+    QVector<MemoryHolder> result;
+    for (shared_ptr<ThinkerBase> const & holder : holders) {
+        MemoryHolder entry;
+        entry.thinker = holder;
+        entry.usage = holder->memoryUsage();
+        result.append(entry);
+    }
+
+    std::sort(
+        result.begin(), result.end(),
+        [] (MemoryHolder const & left, MemoryHolder const & right) {
+            if (left.usage.pinnedBytes != right.usage.pinnedBytes)
+                return left.usage.pinnedBytes > right.usage.pinnedBytes;
+            return left.usage.currentBytes > right.usage.currentBytes;
         }
+    );
+
+    if (count >= 0 and result.size() > count)
+        result.resize(count);
+    return result;
+}
+
+
+QVector<shared_ptr<ThinkerBase>> ThinkerManager::lockTrackedThinkers () {
+    QVector<shared_ptr<ThinkerBase>> result;
+    result.reserve(_thinkers.size());
+
+    for (std::weak_ptr<ThinkerBase> const & weak : _thinkers) {
+        shared_ptr<ThinkerBase> holder = weak.lock();
+        if (holder != nullptr)
+            result.append(holder);
     }
+    return result;
+}
 
-    // there is a notification throttler for all thinkers.  Review: should it
-    // be possible to have a separate notification for groups?
-    _anyThinkerWrittenThrottler.emitThrottled();
+
+void ThinkerManager::trackThinker (shared_ptr<ThinkerBase> holder) {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _thinkers.insert(holder.get(), holder);
+}
+
+
+void ThinkerManager::forgetThinker (ThinkerBase & thinker) {
+    hopefullyCurrentThreadIsManager(HERE);
+
+    _thinkers.remove(&thinker);
+}
+
+
+void ThinkerManager::addToMetricsTotals (
+    ThinkerMetrics const & metrics,
+    bool wasCanceled
+) {
+    QMutexLocker lock (&_metricsMutex);
+
+    if (wasCanceled)
+        _metricsTotals.canceledCount++;
+    else
+        _metricsTotals.finishedCount++;
+    _metricsTotals.sum += metrics;
 }
 
 
@@ -309,11 +1032,15 @@ void ThinkerManager::addToThinkerMap (shared_ptr<ThinkerRunner> runner) {
     // If a Runner exists, then we look to its state information for
     // cancellation--not the Thinker.
 
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
 
     ThinkerBase & thinker = runner->getThinker();
     hopefully(not _thinkerMap.contains(&thinker), HERE);
     _thinkerMap.insert(&thinker, runner);
+
+    // If there was an equal thinker we couldn't join, this one replaces it
+    if (not thinker._cacheKey.isEmpty())
+        _inFlightMap.insert(thinker._cacheKey, runner);
 }
 
 
@@ -323,15 +1050,40 @@ void ThinkerManager::removeFromThinkerMap (
 ) {
     using State = ThinkerBase::State;
 
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
 
     ThinkerBase & thinker = runner->getThinker();
-    hopefully(_thinkerMap.remove(&thinker) == 1, HERE);
+    int removed = _thinkerMap.remove(&thinker);
+    hopefully(removed == 1, HERE);
+
+    if (
+        not thinker._cacheKey.isEmpty()
+        and (_inFlightMap.value(thinker._cacheKey, nullptr) == runner)
+    ) {
+        _inFlightMap.remove(thinker._cacheKey);
+    }
 
     hopefully(thinker._state == State::ThinkerOwnedByRunner, HERE);
     thinker._state = wasCanceled
         ? State::ThinkerCanceled
         : State::ThinkerFinished;
+    lock.unlock();
+
+    // Keyed thinkers are coalesced whether or not there is a cache, so only
+    // bother the manager thread if there is somewhere to put the result
+    bool cacheIt = not wasCanceled
+        and not thinker._cacheKey.isEmpty()
+        and (_cachingResults.loadAcquire() != 0);
+
+    if (cacheIt) {
+        ThinkerMutexLocker cacheLock (&_cacheMutex);
+        _runnersToCache.append(runner);
+        cacheLock.unlock();
+
+        emit cacheInsertMayBeNeeded();
+    }
+
+    thinker.retire(wasCanceled);
 }
 
 
@@ -339,7 +1091,7 @@ void ThinkerManager::addToThreadMap (
     shared_ptr<ThinkerRunner> runner,
     QThread & thread
 ) {
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
 
     hopefully(not _threadMap.contains(&thread), HERE);
     _threadMap.insert(&thread, runner);
@@ -352,28 +1104,29 @@ void ThinkerManager::removeFromThreadMap (
 ) {
     Q_UNUSED(runner);
 
-    QMutexLocker lock (&_mapsMutex);
+    ThinkerMutexLocker lock (&_mapsMutex);
 
-    hopefully(_threadMap.remove(&thread) == 1, HERE);
+    int removed = _threadMap.remove(&thread);
+    hopefully(removed == 1, HERE);
 }
 
 
 void ThinkerManager::waitForPushToThread (ThinkerRunner * runner) {
     hopefullyCurrentThreadIsThinker(HERE);
 
-    QMutexLocker lock (&_pushThreadMutex);
+    ThinkerMutexLocker lock (&_pushThreadMutex);
 
     _runnerSetToPush.insert(runner);
     _threadsNeedPushing.wakeOne();
     emit pushToThreadMayBeNeeded();
-    _threadsWerePushed.wait(&_pushThreadMutex);
+    _pushThreadMutex.waitOn(_threadsWerePushed);
 }
 
 
 void ThinkerManager::processThreadPushesUntil (ThinkerRunner * runner) {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_pushThreadMutex);
+    ThinkerMutexLocker lock (&_pushThreadMutex);
     forever {
         bool found = false;
         for (ThinkerRunner * runnerToPush : _runnerSetToPush) {
@@ -385,7 +1138,7 @@ void ThinkerManager::processThreadPushesUntil (ThinkerRunner * runner) {
         _threadsWerePushed.wakeAll();
         if (found or not runner)
             return;
-        _threadsNeedPushing.wait(&_pushThreadMutex);
+        _pushThreadMutex.waitOn(_threadsNeedPushing);
     }
 }
 
@@ -398,12 +1151,26 @@ void ThinkerManager::doThreadPushesIfNecessary () {
 ThinkerManager::~ThinkerManager () {
     hopefullyCurrentThreadIsManager(HERE);
 
+    // Cached thinkers check in with us as they are destroyed, so let them go
+    // while we are still whole
+    _resultCache.clear();
+
+    // Continuations whose inputs never retired would wait forever
+    QVector<shared_ptr<ThinkerRunner>> runners;
+    {
+        ThinkerMutexLocker lock (&_mapsMutex);
+        for (shared_ptr<ThinkerRunner> runner : _thinkerMap)
+            runners.append(runner);
+    }
+    for (shared_ptr<ThinkerRunner> & runner : runners)
+        runner->cancelIfWaitingForInputs();
+
     // We catch you with an assertion if you do not make sure all your
     // Presents have been either canceled or completed
     bool anyRunners = false;
 
     {
-        QMutexLocker lock (&_mapsMutex);
+        ThinkerMutexLocker lock (&_mapsMutex);
 
         for (shared_ptr<ThinkerRunner> runner : _thinkerMap) {
             hopefully(runner->isCanceled() or runner->isFinished(), HERE);
@@ -413,4 +1180,8 @@ ThinkerManager::~ThinkerManager () {
 
     if (anyRunners)
         QThreadPool::globalInstance()->waitForDone();
+
+    // The pool is quiet now, so the profile covers everything that ran
+    if (ThinkerLockProfile::isEnabled())
+        qDebug().noquote() << ThinkerLockProfile::reportText();
 }
@@ -29,6 +29,7 @@
 
 ThinkerPresentBase::ThinkerPresentBase () :
     _holder (nullptr),
+    _sharerLeft (),
     _thread (QThread::currentThread())
 {
 }
@@ -38,8 +39,10 @@ ThinkerPresentBase::ThinkerPresentBase (
     ThinkerPresentBase const & other
 ) :
     _holder (other._holder),
+    _sharerLeft (other._sharerLeft),
     _thread (QThread::currentThread())
 {
+    holderAcquired();
 }
 
 
@@ -47,8 +50,24 @@ ThinkerPresentBase::ThinkerPresentBase (
     shared_ptr<ThinkerBase> _holder
 ) :
     _holder (_holder),
+    _sharerLeft (make_shared<QAtomicInt>(0)),
     _thread (QThread::currentThread())
 {
+    holderAcquired();
+}
+
+
+void ThinkerPresentBase::holderAcquired () {
+    if (_holder)
+        _holder->presentAcquired();
+}
+
+
+void ThinkerPresentBase::holderReleased () {
+    // Must happen while we still hold the reference, as the manager may need
+    // to look the thinker up if this was the last Present
+    if (_holder)
+        _holder->presentReleased();
 }
 
 
@@ -74,12 +93,18 @@ ThinkerPresentBase & ThinkerPresentBase::operator= (
     const ThinkerPresentBase & other
 ) {
     if (this != &other) {
+        if (other._holder)
+            other._holder->presentAcquired();
+        holderReleased();
         _holder = other._holder;
+        _sharerLeft = other._sharerLeft;
     }
     return *this;
 }
 
 
+#if not THINKERQT_NO_CHECKS
+
 bool ThinkerPresentBase::hopefullyCurrentThreadIsDifferent (
     codeplace const & cp
 )
@@ -101,6 +126,8 @@ bool ThinkerPresentBase::hopefullyCurrentThreadIsDifferent (
     return hopefully(QThread::currentThread() != runner->thread(), cp);
 }
 
+#endif
+
 
 ThinkerBase & ThinkerPresentBase::getThinkerBase () {
     return *_holder;
@@ -112,68 +139,41 @@ ThinkerBase const & ThinkerPresentBase::getThinkerBase () const {
 }
 
 
-bool ThinkerPresentBase::isCanceled () const {
-    using State = ThinkerBase::State;
-
-    hopefullyCurrentThreadIsDifferent(HERE);
+// UIs poll these for hundreds of Presents each frame, so they are answered
+// from the status word the runner publishes (see ThinkerBase::_status).
+// That is one atomic load: no thread check, no map lookup and no locking.
 
+bool ThinkerPresentBase::isCanceled () const {
     // If there are global objects or value members of classes before
     // manager is started...
     if (not _holder)
         return true;
 
-    ThinkerBase const & thinker = getThinkerBase();
-    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
-    bool result = false;
-    if (runner == nullptr) {
-        result = (thinker._state == State::ThinkerCanceled);
-    } else {
-        result = runner->isCanceled();
-    }
-    return result;
+    int status = getThinkerBase()._status.loadAcquire();
+    return (status & ThinkerBase::StatusCanceled) != 0;
 }
 
 
 bool ThinkerPresentBase::isFinished () const {
-    using State = ThinkerBase::State;
-
-    hopefullyCurrentThreadIsDifferent(HERE);
-
     if (_holder == nullptr) {
         // This return statement was commented out.  Why?
         hopefullyNotReached(HERE);
         return false;
     }
 
-    ThinkerBase const & thinker = getThinkerBase();
-    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
-    bool result = false;
-    if (runner == nullptr) {
-        result = (thinker._state == State::ThinkerFinished);
-    } else {
-        result = runner->isFinished();
-    }
-    return result;
+    int status = getThinkerBase()._status.loadAcquire();
+    return (status & ThinkerBase::StatusFinished) != 0;
 }
 
 
 bool ThinkerPresentBase::isPaused () const {
-    hopefullyCurrentThreadIsDifferent(HERE);
-
     if (_holder == nullptr) {
         // This return statement was commented out.  Why?
         return false;
     }
 
-    ThinkerBase const & thinker = getThinkerBase();
-    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
-    bool result = false;
-    if (runner == nullptr) {
-        // the thinker has either finished or been canceled
-    } else {
-        result = runner->isPaused();
-    }
-    return result;
+    int status = getThinkerBase()._status.loadAcquire();
+    return (status & ThinkerBase::StatusPaused) != 0;
 }
 
 
@@ -190,8 +190,21 @@ void ThinkerPresentBase::cancel () {
     ThinkerBase & thinker (getThinkerBase());
     auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
     if (runner == nullptr) {
-        thinker._state = State::ThinkerCanceled;
+        // As with QFuture, canceling something that finished does nothing.
+        // (Finished thinkers may be shared through the result cache, too.)
+        if (thinker._state != State::ThinkerFinished)
+            thinker.setCanceledWithoutRunner();
     } else {
+        // A thinker that other run() calls joined keeps going until each of
+        // them has canceled.  Canceling again through another copy of the
+        // same Present doesn't count twice.
+        if (_sharerLeft != nullptr) {
+            if (not _sharerLeft->testAndSetOrdered(0, 1))
+                return;
+            if (not thinker.leaveSharers())
+                return;
+        }
+
         // No need to enforceCancel at this point (which would cause a
         // synchronous pause of the worker thread that we'd like to avoid)
         // ...although unruly thinkers may seem to "leak" if they stall too
@@ -272,6 +285,130 @@ void ThinkerPresentBase::waitForFinished () {
 }
 
 
+quint64 ThinkerPresentBase::version () const {
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return 0;
+
+    return getThinkerBase().version();
+}
+
+
+bool ThinkerPresentBase::waitForVersionAfter (
+    quint64 version,
+    unsigned long time
+) {
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return false;
+
+    return getThinkerBase().waitForVersionAfter(version, time);
+}
+
+
+int ThinkerPresentBase::progressMaximum () const {
+    if (not _holder)
+        return 0;
+
+    return getThinkerBase()._progressMaximum.loadAcquire();
+}
+
+
+int ThinkerPresentBase::progressMinimum () const {
+    if (not _holder)
+        return 0;
+
+    return getThinkerBase()._progressMinimum.loadAcquire();
+}
+
+
+QString ThinkerPresentBase::progressText () const {
+    if (not _holder)
+        return QString ();
+
+    ThinkerBase const & thinker = getThinkerBase();
+
+    QMutexLocker lock (&thinker._progressTextMutex);
+    return thinker._progressText;
+}
+
+
+int ThinkerPresentBase::progressValue () const {
+    if (not _holder)
+        return 0;
+
+    return getThinkerBase()._progressValue.loadAcquire();
+}
+
+
+int ThinkerPresentBase::resultCount () const {
+    if (not _holder)
+        return 0;
+
+    ResultLogBase const * log = resultSlot().loadAcquire();
+    return log ? log->count() : 0;
+}
+
+
+QAtomicPointer<ResultLogBase> const & ThinkerPresentBase::resultSlot () const {
+    hopefully(_holder != nullptr, HERE);
+
+    return getThinkerBase()._results;
+}
+
+
+QAtomicPointer<ThinkerInboxBase> & ThinkerPresentBase::inboxSlot () {
+    hopefully(_holder != nullptr, HERE);
+
+    return getThinkerBase()._inbox;
+}
+
+
+void ThinkerPresentBase::messagePosted () {
+    // Only a thinker in a timed wasPauseRequested() needs waking, and it
+    // raises this flag before its last look at the inbox (see there).  So
+    // the usual post, to a thinker that is busy, takes no locks.
+    ThinkerBase & thinker = getThinkerBase();
+    if (thinker._waitingForMessages.loadAcquire() == 0)
+        return;
+
+    // Without a runner the thinker is queued, finished or canceled, so there
+    // is nobody waiting to wake.  A queued thinker will find the message
+    // when it gets around to polling.
+    auto runner = thinker.getManager().maybeGetRunnerForThinker(thinker);
+    if (runner != nullptr)
+        runner->messagePosted();
+}
+
+
+ThinkerMetrics ThinkerPresentBase::metrics () const {
+    if (not _holder)
+        return ThinkerMetrics ();
+
+    ThinkerBase const & thinker = getThinkerBase();
+
+    thinker._metricsMutex.lock();
+    ThinkerMetrics result = thinker._metrics;
+    thinker._metricsMutex.unlock();
+
+    result.publishCount = thinker.version();
+    result.bytesDetached = thinker.bytesDetached();
+    return result;
+}
+
+
+SnapshottableMemoryUsage ThinkerPresentBase::memoryUsage () const {
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (not _holder)
+        return SnapshottableMemoryUsage ();
+
+    return getThinkerBase().memoryUsage();
+}
+
+
 SnapshotBase * ThinkerPresentBase::createSnapshotBase () const {
     hopefullyCurrentThreadIsDifferent(HERE);
 
@@ -283,4 +420,6 @@ SnapshotBase * ThinkerPresentBase::createSnapshotBase () const {
 
 ThinkerPresentBase::~ThinkerPresentBase () {
     hopefully(QThread::currentThread() == _thread, HERE);
+
+    holderReleased();
 }
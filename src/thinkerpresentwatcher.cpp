@@ -19,13 +19,48 @@
 // See http://hostilefork.com/thinker-qt/ for more information on this project
 //
 
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+
 #include "thinkerqt/thinkerpresentwatcher.h"
 #include "thinkerqt/thinker.h"
 
+
+// Stamps are taken on whichever thread sees each step, against one clock.
+// They are offset by one so that zero can mean "not stamped yet".
+
+struct ThinkerPresentWatcherBase::LatencyTrace {
+    LatencyTrace () :
+        writtenAt (0),
+        throttledAt (0),
+        deliveredAt (0)
+    {
+        clock.start();
+    }
+
+    qint64 now () const {
+        return clock.nsecsElapsed() + 1;
+    }
+
+    QElapsedTimer clock;
+    QAtomicInteger<qint64> writtenAt; // first write the consumer hasn't seen
+    QAtomicInteger<qint64> throttledAt;
+    QAtomicInteger<qint64> deliveredAt;
+
+    mutable QMutex histogramsMutex;
+    LatencyHistogram histograms[5]; // indexed by LatencyStage
+};
+
 ThinkerPresentWatcherBase::ThinkerPresentWatcherBase () :
     _present (),
+    _active (true),
     _milliseconds (200),
-    _notificationThrottler ()
+    _progressMilliseconds (100),
+    _notificationThrottler (),
+    _progressThrottler (),
+    _resultsThrottler (),
+    _latencyTrace ()
 {
     hopefullyCurrentThreadIsDifferent(HERE);
 }
@@ -35,11 +70,16 @@ ThinkerPresentWatcherBase::ThinkerPresentWatcherBase (
     ThinkerPresentBase present
 ) :
     _present (present),
+    _active (true),
     // we parent the SignalThrottler to the thinker so that they'll have the
     // same thread affinity after the reparenting.  But is 200 milliseconds
     // a good default?
     _milliseconds (200),
-    _notificationThrottler ()
+    _progressMilliseconds (100),
+    _notificationThrottler (),
+    _progressThrottler (),
+    _resultsThrottler (),
+    _latencyTrace ()
 {
     hopefullyCurrentThreadIsDifferent(HERE);
     doConnections();
@@ -53,9 +93,55 @@ void ThinkerPresentWatcherBase::doConnections () {
             new SignalThrottler (_milliseconds, &_present.getThinkerBase())
         );
 
+        if (_latencyTrace) {
+            // Stamp the emit where it happens, and go through a slot on our
+            // own thread to stamp the delivery before passing it on.  The
+            // stamp runs on the thinker's thread, where an emit can still be
+            // under way after we disconnect; the connection holds its own
+            // reference so turning tracing off can't free the trace under it
+            shared_ptr<LatencyTrace> trace = _latencyTrace;
+            connect(
+                _notificationThrottler.data(), &SignalThrottler::throttled,
+                this, [trace] () {
+                    trace->throttledAt.testAndSetOrdered(0, trace->now());
+                },
+                Qt::DirectConnection
+            );
+
+            connect(
+                _notificationThrottler.data(), &SignalThrottler::throttled,
+                this, &ThinkerPresentWatcherBase::latencyDelivered,
+                Qt::AutoConnection
+            );
+        } else {
+            connect(
+                _notificationThrottler.data(), &SignalThrottler::throttled,
+                this, &ThinkerPresentWatcherBase::written,
+                Qt::AutoConnection
+            );
+        }
+
+        // Progress needs no snapshot to display, so it gets its own (and by
+        // default shorter) throttle rather than waking up written() handlers
+        _progressThrottler = QSharedPointer<SignalThrottler>(
+            new SignalThrottler (
+                _progressMilliseconds, &_present.getThinkerBase()
+            )
+        );
+
         connect(
-            _notificationThrottler.data(), &SignalThrottler::throttled,
-            this, &ThinkerPresentWatcherBase::written,
+            _progressThrottler.data(), &SignalThrottler::throttled,
+            this, &ThinkerPresentWatcherBase::progressChanged,
+            Qt::AutoConnection
+        );
+
+        _resultsThrottler = QSharedPointer<SignalThrottler>(
+            new SignalThrottler (_milliseconds, &_present.getThinkerBase())
+        );
+
+        connect(
+            _resultsThrottler.data(), &SignalThrottler::throttled,
+            this, &ThinkerPresentWatcherBase::resultsReported,
             Qt::AutoConnection
         );
 
@@ -70,10 +156,10 @@ void ThinkerPresentWatcherBase::doConnections () {
         // "finished" re-broadcast
         ThinkerBase & thinker = this->_present.getThinkerBase();
 
-        QWriteLocker lock (&thinker._watchersLock);
-        
-        hopefully(not thinker._watchers.contains(this), HERE);
-        thinker._watchers.insert(this);
+        thinker.attachListener(*this);
+
+        if (_active)
+            thinker.watcherActivated();
     } else {
         hopefully(not _notificationThrottler, HERE);
     }
@@ -86,16 +172,43 @@ void ThinkerPresentWatcherBase::doDisconnections () {
         // note that a signal may still be in the queue
         ThinkerBase & thinker = this->_present.getThinkerBase();
 
-        QWriteLocker lock (&thinker._watchersLock);
-        hopefully(thinker._watchers.remove(this), HERE);
+        if (_active)
+            thinker.watcherDeactivated();
+
+        thinker.detachListener(*this);
 
         _notificationThrottler = QSharedPointer<SignalThrottler>();
+        _progressThrottler = QSharedPointer<SignalThrottler>();
+        _resultsThrottler = QSharedPointer<SignalThrottler>();
     } else {
         hopefully(not _notificationThrottler, HERE);
     }
 }
 
 
+void ThinkerPresentWatcherBase::thinkerWritten () {
+    if (_latencyTrace)
+        _latencyTrace->writtenAt.testAndSetOrdered(0, _latencyTrace->now());
+
+    _notificationThrottler->emitThrottled();
+}
+
+
+void ThinkerPresentWatcherBase::thinkerRetired (bool wasCanceled) {
+    Q_UNUSED(wasCanceled);
+}
+
+
+void ThinkerPresentWatcherBase::thinkerProgressed () {
+    _progressThrottler->emitThrottled();
+}
+
+
+void ThinkerPresentWatcherBase::thinkerResultsReported () {
+    _resultsThrottler->emitThrottled();
+}
+
+
 void ThinkerPresentWatcherBase::setPresentBase (ThinkerPresentBase present) {
     hopefullyCurrentThreadIsDifferent(HERE);
 
@@ -110,6 +223,117 @@ void ThinkerPresentWatcherBase::setPresentBase (ThinkerPresentBase present) {
 }
 
 
+void ThinkerPresentWatcherBase::setActive (bool active) {
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (_active == active)
+        return;
+
+    _active = active;
+
+    if (_present == ThinkerPresentBase())
+        return;
+
+    if (active)
+        _present.getThinkerBase().watcherActivated();
+    else
+        _present.getThinkerBase().watcherDeactivated();
+}
+
+
+SnapshotBase * ThinkerPresentWatcherBase::createSnapshotBase () const {
+    if (not _latencyTrace)
+        return _present.createSnapshotBase();
+
+    LatencyTrace & trace = *_latencyTrace;
+
+    // Taking the stamps before the snapshot means writes that land during
+    // it are counted again next time, rather than not at all
+    qint64 requestedAt = trace.now();
+    qint64 writtenAt = trace.writtenAt.fetchAndStoreOrdered(0);
+    qint64 throttledAt = trace.throttledAt.fetchAndStoreOrdered(0);
+    qint64 deliveredAt = trace.deliveredAt.fetchAndStoreOrdered(0);
+
+    SnapshotBase * snapshot = _present.createSnapshotBase();
+
+    qint64 obtainedAt = trace.now();
+
+    QMutexLocker lock (&trace.histogramsMutex);
+
+    auto record = [&] (LatencyStage stage, qint64 from, qint64 to) {
+        trace.histograms[static_cast<int>(stage)].record(to - from);
+    };
+
+    record(LatencyStage::Snapshot, requestedAt, obtainedAt);
+
+    if (writtenAt != 0) {
+        record(LatencyStage::Total, writtenAt, obtainedAt);
+
+        // A stamp from before the write belongs to an emit for an older one
+        bool inOrder = (throttledAt >= writtenAt)
+            and (deliveredAt >= throttledAt);
+        if (throttledAt != 0 and deliveredAt != 0 and inOrder) {
+            record(LatencyStage::Throttle, writtenAt, throttledAt);
+            record(LatencyStage::Dispatch, throttledAt, deliveredAt);
+            record(LatencyStage::Handler, deliveredAt, requestedAt);
+        }
+    }
+
+    return snapshot;
+}
+
+
+void ThinkerPresentWatcherBase::setLatencyTracing (bool tracing) {
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    if (tracing == isLatencyTracing())
+        return;
+
+    // The listener and throttler read the trace from other threads, so
+    // detach them while it changes
+    doDisconnections();
+
+    if (tracing)
+        _latencyTrace = make_shared<LatencyTrace>();
+    else
+        _latencyTrace.reset();
+
+    doConnections();
+}
+
+
+LatencyHistogram ThinkerPresentWatcherBase::latencyHistogram (
+    LatencyStage stage
+)
+    const
+{
+    if (not _latencyTrace)
+        return LatencyHistogram ();
+
+    QMutexLocker lock (&_latencyTrace->histogramsMutex);
+    return _latencyTrace->histograms[static_cast<int>(stage)];
+}
+
+
+void ThinkerPresentWatcherBase::resetLatencyHistograms () {
+    if (not _latencyTrace)
+        return;
+
+    QMutexLocker lock (&_latencyTrace->histogramsMutex);
+    for (LatencyHistogram & histogram : _latencyTrace->histograms)
+        histogram = LatencyHistogram ();
+}
+
+
+void ThinkerPresentWatcherBase::latencyDelivered () {
+    // May have been queued before tracing was turned off
+    if (_latencyTrace)
+        _latencyTrace->deliveredAt.testAndSetOrdered(0, _latencyTrace->now());
+
+    emit written();
+}
+
+
 ThinkerPresentBase ThinkerPresentWatcherBase::presentBase () {
     hopefullyCurrentThreadIsDifferent(HERE);
 
@@ -123,6 +347,19 @@ void ThinkerPresentWatcherBase::setThrottleTime (unsigned int milliseconds) {
     this->_milliseconds = milliseconds;
     if (_notificationThrottler) {
         _notificationThrottler->setMillisecondsDefault(milliseconds);
+        _resultsThrottler->setMillisecondsDefault(milliseconds);
+    }
+}
+
+
+void ThinkerPresentWatcherBase::setProgressThrottleTime (
+    unsigned int milliseconds
+) {
+    hopefullyCurrentThreadIsDifferent(HERE);
+
+    this->_progressMilliseconds = milliseconds;
+    if (_progressThrottler) {
+        _progressThrottler->setMillisecondsDefault(milliseconds);
     }
 }
 
@@ -20,10 +20,34 @@
 //
 
 #include <QMutexLocker>
+#include <QThreadPool>
 #include <QDebug>
 
+#include <time.h>
+
 #include "thinkerqt/thinkerrunner.h"
 #include "thinkerqt/thinkermanager.h"
+#include "thinkerqt/thinkertrace.h"
+#include "thinkerqt/thinkerprobes.h"
+
+
+// CPU time of the calling thread, for ThinkerMetrics.  Only differences
+// between two calls on the same thread mean anything.
+
+static qint64 threadCpuNsecs () {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0)
+        return now.tv_sec * Q_INT64_C(1000000000) + now.tv_nsec;
+#endif
+    return 0;
+}
+
+
+// Set by ThinkerRunnerProxy::run() while its runner is running on this
+// thread.  See ThinkerRunner::currentMaybeNull().
+
+static thread_local ThinkerRunner * currentRunner = nullptr;
 
 
 // operator<< for ThinkerRunner::State
@@ -35,44 +59,40 @@ inline QTextStream & operator<< (
     QTextStream & o,
     ThinkerRunner::State const & state
 ) {
-    using State = ThinkerRunner::State;
+    o << "ThinkerRunner::State::" << ThinkerRunner::stateName(state);
+    return o;
+}
+
 
-    o << "ThinkerRunner::State::";
+// Also used to name the spans on a thinker's trace track, which is why
+// it gives back literals
+
+char const * ThinkerRunner::stateName (State state) {
     switch (state) {
     case State::Queued:
-        o << "Queued";
-        break;
+        return "Queued";
     case State::QueuedButPaused:
-        o << "QueuedButPaused";
-        break;
+        return "QueuedButPaused";
     case State::ThreadPush:
-        o << "ThreadPush";
-        break;
+        return "ThreadPush";
     case State::Thinking:
-        o << "Thinking";
-        break;
+        return "Thinking";
     case State::Pausing:
-        o << "Pausing";
-        break;
+        return "Pausing";
     case State::Paused:
-        o << "Paused";
-        break;
+        return "Paused";
     case State::Resuming:
-        o << "Resuming";
-        break;
+        return "Resuming";
     case State::Finished:
-        o << "Finished";
-        break;
+        return "Finished";
     case State::Canceling:
-        o << "Canceling";
-        break;
+        return "Canceling";
     case State::Canceled:
-        o << "Canceled";
-        break;
+        return "Canceled";
     default:
         hopefullyNotReached(HERE);
     }
-    return o;
+    return "";
 }
 
 
@@ -100,7 +120,7 @@ void ThinkerRunnerHelper::markFinished () {
 
     hopefullyCurrentThreadIsRun(HERE);
 
-    QMutexLocker lock (&_runner._stateMutex);
+    ThinkerMutexLocker lock (&_runner._stateMutex);
 
     if (_runner._state == State::Canceling) {
         // we don't let it transition to finished if abort is requested
@@ -110,6 +130,8 @@ void ThinkerRunnerHelper::markFinished () {
             HERE
         );
         _runner._state.hopefullyAlter(State::Finished, HERE);
+        _runner.publishStatus();
+        THINKERQT_PROBE(finish, &_runner.getThinker());
         _runner._stateWasChanged.wakeOne();
         _runner.quit();
     }
@@ -129,11 +151,43 @@ ThinkerRunnerHelper::~ThinkerRunnerHelper () {
 ThinkerRunner::ThinkerRunner (shared_ptr<ThinkerBase> holder) :
     QEventLoop (),
     _state (State::Queued, HERE),
+    _stateWasChanged (),
+    _stateMutex (ThinkerLockProfile::Site::RunnerState),
+    _nudgeArrived (),
+    _nudged (false),
     _holder (holder),
-    _helper ()
+    _helper (),
+    _thinkerAdrift (false),
+    _abandonInputs (),
+    _autoPaused (false),
+    _resumeWhenPaused (false),
+    _parked (false),
+    _metricsEnabled (false),
+    _metricsClock (),
+    _pauseRequestedAt (0),
+    _traceTrack (0),
+    _tracedState (nullptr)
 {
     hopefully(_holder != nullptr, HERE);
 
+    _metricsEnabled = getManager().metricsEnabled();
+    if (_metricsEnabled)
+        _metricsClock.start();
+
+    if (ThinkerTrace::isEnabled()) {
+        ThinkerBase const & thinker = getThinker();
+        QString label = thinker.objectName();
+        if (label.isEmpty())
+            label = QString::fromLatin1(thinker.metaObject()->className());
+
+        // The outer span, named by the label, lasts as long as the runner
+        _traceTrack = ThinkerTrace::newTrack(label);
+        ThinkerTrace::beginOnTrack(_traceTrack, nullptr);
+
+        _tracedState = stateName(State::Queued);
+        ThinkerTrace::beginOnTrack(_traceTrack, _tracedState);
+    }
+
     // need to check this, because we will later ask the manager to move the
     // Thinker to the thread of the QRunnable (when we find out what that
     // thread is; we don't know until the Thread Pool decides to run this).
@@ -161,6 +215,8 @@ ThinkerRunner::ThinkerRunner (shared_ptr<ThinkerBase> holder) :
 }
 
 
+#if not THINKERQT_NO_CHECKS
+
 bool ThinkerRunner::hopefullyCurrentThreadIsNotThinker (
     codeplace const & cp
 ) const
@@ -188,6 +244,8 @@ bool ThinkerRunner::hopefullyCurrentThreadIsRun (
     return _helper->hopefullyCurrentThreadIsRun(cp);
 }
 
+#endif
+
 
 ThinkerManager & ThinkerRunner::getManager () const
 {
@@ -195,6 +253,11 @@ ThinkerManager & ThinkerRunner::getManager () const
 }
 
 
+ThinkerRunner * ThinkerRunner::currentMaybeNull () {
+    return currentRunner;
+}
+
+
 ThinkerBase const & ThinkerRunner::getThinker () const {
     return *_holder;
 }
@@ -208,22 +271,75 @@ ThinkerBase & ThinkerRunner::getThinker () {
 void ThinkerRunner::doThreadPushIfNecessary () {
     hopefullyCurrentThreadIsManager(HERE);
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
 
     if (_state == State::ThreadPush) {
         hopefully(_helper, HERE);
+
+        ThinkerTrace::beginSpan("thread push");
         getThinker().moveToThread(_helper->thread());
+        ThinkerTrace::endSpan("thread push");
+
         _state.hopefullyAlter(State::Thinking, HERE);
+        publishStatus();
+        _stateWasChanged.wakeOne();
+    }
+}
+
+
+void ThinkerRunner::setThinkerAdrift (
+    std::function<void ()> abandonInputs
+) {
+    hopefullyCurrentThreadIsManager(HERE);
+    hopefully(getThinker().thread() == QThread::currentThread(), HERE);
+
+    ThinkerMutexLocker lock (&_stateMutex);
+    _state.hopefullyEqualTo(State::Queued, HERE);
+
+    // QObject allows an object with no thread affinity to be pulled onto the
+    // current thread, which is the one exception to only pushing
+    getThinker().moveToThread(nullptr);
+    _thinkerAdrift = true;
+    _abandonInputs = abandonInputs;
+}
+
+
+void ThinkerRunner::cancelBeforeRun () {
+    // This is for continuations whose inputs were canceled.  It can't go
+    // through requestCancel(), because it happens on whatever pool thread
+    // retired the last input and that's not where pushes get processed.
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    if ((_state == State::Queued) or (_state == State::QueuedButPaused)) {
+        _state.hopefullyAlter(State::Canceled, HERE);
+        publishStatus();
+        THINKERQT_PROBE(canceled, &getThinker());
         _stateWasChanged.wakeOne();
+    } else {
+        _state.hopefullyEqualTo(State::Canceled, HERE);
     }
 }
 
 
-bool ThinkerRunner::runThinker () {
+void ThinkerRunner::cancelIfWaitingForInputs () {
+    if (_thinkerAdrift)
+        _abandonInputs();
+}
+
+
+ThinkerRunner::Outcome ThinkerRunner::runThinker () {
+    ThinkerMetrics metrics;
+    if (_metricsEnabled)
+        metrics.queueWaitNsecs = _metricsClock.nsecsElapsed();
+
     _stateMutex.lock();
 
     if (_state == State::QueuedButPaused) {
-        _stateWasChanged.wait(&_stateMutex);
+        // Waiting here would keep a pool thread from thinkers that are
+        // wanted, for as long as the pause lasts
+        _parked = true;
+        _stateMutex.unlock();
+        return Outcome::Parked;
     }
     _state.hopefullyInSet(State::Queued, State::Canceled, HERE);
 
@@ -247,14 +363,38 @@ bool ThinkerRunner::runThinker () {
         );
 
         QThread * originalThinkerThread = getThinker().thread();
-        // Now that we know what thread the Thinker will be running on, we ask
-        // the main thread to push it onto our current thread allocated to us
-        // by the pool
-        _state.hopefullyAlter(State::ThreadPush, HERE);
-        _stateWasChanged.wakeOne();
-        _stateMutex.unlock();
 
-        getManager().waitForPushToThread(this);
+        if (_thinkerAdrift) {
+            // A continuation's thinker had its thread affinity cleared when
+            // it was created, so that whichever pool thread runs it can pull
+            // it over without a round trip to the manager thread.  It still
+            // goes back to the manager thread when it is done, as the
+            // destructor expects to run there.
+            hopefully(originalThinkerThread == nullptr, HERE);
+            getThinker().moveToThread(QThread::currentThread());
+            originalThinkerThread = getManager().thread();
+
+            _state.hopefullyAlter(State::Thinking, HERE);
+            publishStatus();
+            _stateWasChanged.wakeOne();
+            _stateMutex.unlock();
+        } else {
+            // Now that we know what thread the Thinker will be running on, we
+            // ask the main thread to push it onto our current thread
+            // allocated to us by the pool
+            _state.hopefullyAlter(State::ThreadPush, HERE);
+            publishStatus();
+            _stateWasChanged.wakeOne();
+            _stateMutex.unlock();
+
+            getManager().waitForPushToThread(this);
+
+            if (_metricsEnabled) {
+                metrics.threadPushNsecs =
+                    _metricsClock.nsecsElapsed() - metrics.queueWaitNsecs;
+                publishMetrics(metrics);
+            }
+        }
 
         // There are two places where the object will be pushed.  One is from
         // the event loop if the signal happens.  But if before that can happen
@@ -274,6 +414,7 @@ bool ThinkerRunner::runThinker () {
         // idle thinker which is waiting for a message could delegate some time
         // to another thinker?
         getThinker().afterThreadAttach();
+        THINKERQT_PROBE(start, &getThinker());
 
         // The thinker thread needs to run until either it has finished (which
         // it indicates by emitting the done() signal)... or until it is
@@ -288,6 +429,13 @@ bool ThinkerRunner::runThinker () {
         while (not didCancelOrFinish) {
 
             if (not skipToPause) {
+                qint64 wallStarted = 0;
+                qint64 cpuStarted = 0;
+                if (_metricsEnabled) {
+                    wallStarted = _metricsClock.nsecsElapsed();
+                    cpuStarted = threadCpuNsecs();
+                }
+
 #ifndef Q_NO_EXCEPTIONS
                 try {
 #endif
@@ -302,6 +450,13 @@ bool ThinkerRunner::runThinker () {
                     possiblyAbleToContinue = false;
                 }
 #endif
+
+                if (_metricsEnabled) {
+                    metrics.thinkingWallNsecs +=
+                        _metricsClock.nsecsElapsed() - wallStarted;
+                    metrics.thinkingCpuNsecs += threadCpuNsecs() - cpuStarted;
+                    publishMetrics(metrics);
+                }
             } else {
                 skipToPause = false;
             }
@@ -327,6 +482,8 @@ bool ThinkerRunner::runThinker () {
                 _state.hopefullyTransition(
                     State::Canceling, State::Canceled, HERE
                 );
+                publishStatus();
+                THINKERQT_PROBE(canceled, &getThinker());
 
                 _stateWasChanged.wakeOne();
                 didCancelOrFinish = true;
@@ -336,8 +493,30 @@ bool ThinkerRunner::runThinker () {
                 _state.hopefullyTransition(
                     State::Pausing, State::Paused, HERE
                 );
+                publishStatus();
+                THINKERQT_PROBE(pause_ack, &getThinker());
+
+                if (_metricsEnabled) {
+                    metrics.pauseLatencyNsecs +=
+                        _metricsClock.nsecsElapsed() - _pauseRequestedAt;
+                    metrics.pauseCount++;
+                    publishMetrics(metrics);
+                }
+
                 _stateWasChanged.wakeOne();
-                _stateWasChanged.wait(&_stateMutex);
+
+                if (_resumeWhenPaused) {
+                    // Demand came back while we were Pausing
+                    _resumeWhenPaused = false;
+                    _autoPaused = false;
+                    _state.hopefullyTransition(
+                        State::Paused, State::Resuming, HERE
+                    );
+                    publishStatus();
+                    THINKERQT_PROBE(resume_request, &getThinker());
+                } else {
+                    _stateMutex.waitOn(_stateWasChanged);
+                }
 
                 // Once we are paused, we just wait for a signal that we are to
                 // either be aborted or continue.  (Because we are paused
@@ -357,6 +536,8 @@ bool ThinkerRunner::runThinker () {
                         State::Resuming, State::Thinking,
                         HERE
                     );
+                    publishStatus();
+                    THINKERQT_PROBE(resume_ack, &getThinker());
                     _stateWasChanged.wakeOne();
                 }
             }
@@ -385,7 +566,40 @@ bool ThinkerRunner::runThinker () {
     bool wasCanceled = (_state != State::Finished);
     _stateMutex.unlock();
 
-    return wasCanceled;
+    if (_metricsEnabled) {
+        publishMetrics(metrics);
+
+        metrics.publishCount = getThinker().version();
+        metrics.bytesDetached = getThinker().bytesDetached();
+        getManager().addToMetricsTotals(metrics, wasCanceled);
+    }
+
+    return wasCanceled ? Outcome::Canceled : Outcome::Finished;
+}
+
+
+bool ThinkerRunner::unparkLocked () {
+    // Caller must hold _stateMutex
+    bool wasParked = _parked;
+    _parked = false;
+    return wasParked;
+}
+
+
+void ThinkerRunner::requeue () {
+    ThinkerRunnerProxy * proxy = new ThinkerRunnerProxy (
+        shared_from_this(), true
+    );
+    proxy->setAutoDelete(true);
+    QThreadPool::globalInstance()->start(proxy);
+}
+
+
+void ThinkerRunner::publishMetrics (ThinkerMetrics const & metrics) {
+    ThinkerBase & thinker = getThinker();
+
+    QMutexLocker lock (&thinker._metricsMutex);
+    thinker._metrics = metrics;
 }
 
 
@@ -397,12 +611,38 @@ void ThinkerRunner::requestPauseCore (
     hopefullyCurrentThreadIsNotThinker(HERE);
     getManager().processThreadPushes();
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    if (_autoPaused) {
+        _autoPaused = false;
+        _resumeWhenPaused = false;
+
+        // Already paused (or on the way there) by the manager; from now on
+        // the pause is the caller's, and stays until they resume it
+        if (
+            (_state == State::QueuedButPaused)
+            or (_state == State::Pausing)
+            or (_state == State::Paused)
+        ) {
+            return;
+        }
+    }
+
+    requestPauseLocked(isPausedOkay, isCanceledOkay, cp);
+}
+
 
+void ThinkerRunner::requestPauseLocked (
+    bool isPausedOkay,
+    bool isCanceledOkay,
+    codeplace const & cp
+) {
+    // Caller must hold _stateMutex
     if (_state == State::Queued) {
         _state.hopefullyTransition(
             State::Queued, State::QueuedButPaused, HERE
         );
+        publishStatus();
         _stateWasChanged.wakeOne();
     } else if (_state == State::Finished) {
         // do nothing
@@ -420,7 +660,15 @@ void ThinkerRunner::requestPauseCore (
         // do nothing
     } else {
         _state.hopefullyTransition(State::Thinking, State::Pausing, cp);
-        _stateWasChanged.wakeOne();
+        publishStatus();
+        THINKERQT_PROBE(pause_request, &getThinker());
+
+        if (_metricsEnabled)
+            _pauseRequestedAt = _metricsClock.nsecsElapsed();
+
+        // The thinker waits on _nudgeArrived, not _stateWasChanged, and
+        // waking the latter here could only confuse waitForFinished()
+        _nudgeArrived.wakeOne();
 
         emit breakEventLoop();
     }
@@ -431,7 +679,7 @@ void ThinkerRunner::waitForPauseCore (bool isCanceledOkay) {
     hopefullyCurrentThreadIsNotThinker(HERE);
     getManager().processThreadPushes();
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
 
     if (
         (_state == State::Finished)
@@ -442,11 +690,11 @@ void ThinkerRunner::waitForPauseCore (bool isCanceledOkay) {
     } else if (isCanceledOkay and (_state == State::Canceled)) {
         // do nothing
     } else if (isCanceledOkay and (_state == State::Canceling)) {
-        _stateWasChanged.wait(&_stateMutex);
+        _stateMutex.waitOn(_stateWasChanged);
         _state.hopefullyEqualTo(State::Canceled, HERE);
     } else {
         _state.hopefullyEqualTo(State::Pausing, HERE);
-        _stateWasChanged.wait(&_stateMutex);
+        _stateMutex.waitOn(_stateWasChanged);
         _state.hopefullyInSet(State::Paused, State::Finished, HERE);
     }
 }
@@ -459,7 +707,20 @@ void ThinkerRunner::requestCancelCore (
     hopefullyCurrentThreadIsNotThinker(cp);
     getManager().processThreadPushes();
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    // A continuation still waiting on its inputs isn't in the pool yet
+    bool abandonInputs = _thinkerAdrift and (
+        (_state == State::Queued) or (_state == State::QueuedButPaused)
+    );
+
+    // A parked runner has to go through the pool to be let go
+    bool requeueNow = false;
+    if (_state == State::QueuedButPaused)
+        requeueNow = unparkLocked();
+
+    _autoPaused = false;
+    _resumeWhenPaused = false;
 
     if (
         (_state == State::Queued)
@@ -468,6 +729,9 @@ void ThinkerRunner::requestCancelCore (
         or (_state == State::QueuedButPaused)
     ) {
         _state.hopefullyAlter(State::Canceled, cp);
+        publishStatus();
+        THINKERQT_PROBE(cancel_request, &getThinker());
+        THINKERQT_PROBE(canceled, &getThinker());
         _stateWasChanged.wakeOne();
     } else if (
         isCanceledOkay and (
@@ -480,10 +744,22 @@ void ThinkerRunner::requestCancelCore (
         // We should not multiply request stops and pauses...
         // so if it's not initializing and not finished it must be thinking!
         _state.hopefullyTransition(State::Thinking, State::Canceling, cp);
-        _stateWasChanged.wakeOne();
+        publishStatus();
+        THINKERQT_PROBE(cancel_request, &getThinker());
+
+        // (see requestPauseCore)
+        _nudgeArrived.wakeOne();
 
         emit breakEventLoop();
     }
+
+    lock.unlock();
+
+    if (abandonInputs)
+        _abandonInputs();
+
+    if (requeueNow)
+        requeue();
 }
 
 
@@ -494,23 +770,93 @@ void ThinkerRunner::requestResumeCore (
     hopefullyCurrentThreadIsNotThinker(cp);
     getManager().processThreadPushes();
 
+    {
+        ThinkerMutexLocker lock (&_stateMutex);
+        _autoPaused = false;
+        _resumeWhenPaused = false;
+    }
+
     waitForPauseCore(isCanceledOkay);
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    bool requeueNow = false;
 
     if (_state == State::QueuedButPaused) {
         _state.hopefullyAlter(State::Queued, HERE);
+        publishStatus();
         _stateWasChanged.wakeOne();
+        requeueNow = unparkLocked();
     } else if (_state == State::Finished) {
         // do nothing
     } else if (isCanceledOkay and (_state == State::Canceled)) {
         // do nothing
     } else {
         _state.hopefullyTransition(State::Paused, State::Resuming, cp);
+        publishStatus();
+        THINKERQT_PROBE(resume_request, &getThinker());
 
         // only one should be waiting, max...
         _stateWasChanged.wakeOne();
     }
+
+    lock.unlock();
+
+    if (requeueNow)
+        requeue();
+}
+
+
+void ThinkerRunner::requestAutoPause (codeplace const & cp) {
+    hopefullyCurrentThreadIsNotThinker(cp);
+    getManager().processThreadPushes();
+
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    if ((_state == State::Pausing) and _resumeWhenPaused) {
+        // Still Pausing from last time, so just don't come back out of it
+        _resumeWhenPaused = false;
+        _autoPaused = true;
+    } else if ((_state == State::Queued) or (_state == State::Thinking)) {
+        requestPauseLocked(false, false, cp);
+        _autoPaused = true;
+    }
+}
+
+
+void ThinkerRunner::requestAutoResume (codeplace const & cp) {
+    hopefullyCurrentThreadIsNotThinker(cp);
+    getManager().processThreadPushes();
+
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    if (not _autoPaused)
+        return;
+    _autoPaused = false;
+
+    if (_state == State::QueuedButPaused) {
+        _state.hopefullyAlter(State::Queued, cp);
+        publishStatus();
+        _stateWasChanged.wakeOne();
+
+        if (unparkLocked()) {
+            lock.unlock();
+            requeue();
+        }
+    } else if (_state == State::Paused) {
+        _state.hopefullyAlter(State::Resuming, cp);
+        publishStatus();
+        THINKERQT_PROBE(resume_request, &getThinker());
+        _stateWasChanged.wakeOne();
+    } else if (_state == State::Pausing) {
+        // Can't resume until the thinker has paused, and we don't wait
+        _resumeWhenPaused = true;
+    } else {
+        // Canceled or finished in the meantime
+        _state.hopefullyInSet(
+            State::Canceling, State::Canceled, State::Finished, cp
+        );
+    }
 }
 
 
@@ -518,7 +864,7 @@ void ThinkerRunner::waitForResume (codeplace const & cp) {
     hopefullyCurrentThreadIsNotThinker(cp);
     getManager().processThreadPushes();
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
 
     if (
         (_state == State::Thinking)
@@ -528,7 +874,7 @@ void ThinkerRunner::waitForResume (codeplace const & cp) {
         // do nothing
     } else {
         _state.hopefullyEqualTo(State::Resuming, HERE);
-        _stateWasChanged.wait(&_stateMutex);
+        _stateMutex.waitOn(_stateWasChanged);
         _state.hopefullyInSet(
             State::Resuming, State::Thinking, State::Finished,
             HERE
@@ -540,9 +886,23 @@ void ThinkerRunner::waitForResume (codeplace const & cp) {
 void ThinkerRunner::waitForFinished (codeplace const & cp) {
     hopefullyCurrentThreadIsNotThinker(cp);
 
-    QMutexLocker lock (&_stateMutex);
-
-    if ((_state == State::Queued) or (_state == State::ThreadPush)) {
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    if (_thinkerAdrift) {
+        // Nobody will ask us for a thread push, but we may have to wait for
+        // the continuation's inputs before it even gets to a thread, and
+        // they may be waiting on this (the manager) thread for their pushes
+        while (
+            (_state == State::Queued) or (_state == State::QueuedButPaused)
+        ) {
+            lock.unlock();
+            getManager().processThreadPushes();
+            lock.relock();
+
+            if ((_state == State::Queued) or (_state == State::QueuedButPaused))
+                _stateMutex.waitOn(_stateWasChanged, 10);
+        }
+    } else if ((_state == State::Queued) or (_state == State::ThreadPush)) {
         lock.unlock();
         getManager().processThreadPushesUntil(this);
         lock.relock();
@@ -551,7 +911,7 @@ void ThinkerRunner::waitForFinished (codeplace const & cp) {
     // Caller should know if they paused the thinker, and resume it before
     // calling this routine!
     if (_state == State::Thinking)
-        _stateWasChanged.wait(&_stateMutex);
+        _stateMutex.waitOn(_stateWasChanged);
 
     _state.hopefullyInSet(State::Canceled, State::Finished, HERE);
 }
@@ -560,7 +920,7 @@ void ThinkerRunner::waitForFinished (codeplace const & cp) {
 bool ThinkerRunner::isFinished () const {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
 
     switch (_state) {
         case State::Queued:
@@ -585,7 +945,7 @@ bool ThinkerRunner::isFinished () const {
 bool ThinkerRunner::isCanceled () const {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
 
     return (_state == State::Canceled)
         or (_state == State::Canceling);
@@ -595,7 +955,7 @@ bool ThinkerRunner::isCanceled () const {
 bool ThinkerRunner::isPaused () const {
     hopefullyCurrentThreadIsNotThinker(HERE);
 
-    QMutexLocker lock (&_stateMutex);
+    ThinkerMutexLocker lock (&_stateMutex);
 
     return (_state == State::Paused)
         or (_state == State::Pausing)
@@ -606,24 +966,128 @@ bool ThinkerRunner::isPaused () const {
 bool ThinkerRunner::wasPauseRequested (unsigned long time) const {
     hopefullyCurrentThreadIsRun(HERE);
 
-    QMutexLocker lock (&_stateMutex);
+    QElapsedTimer elapsed;
+    if (time != 0)
+        elapsed.start();
 
-    if ((_state == State::Pausing) or (_state == State::Canceling))
-        return true;
+    ThinkerMutexLocker lock (&_stateMutex);
 
-    _state.hopefullyEqualTo(State::Thinking, HERE);
-    if (time == 0)
-        return false;
+    while (true) {
+        if ((_state == State::Pausing) or (_state == State::Canceling))
+            return true;
 
-    bool didStateChange = _stateWasChanged.wait(&_stateMutex, time);
-    if (didStateChange) {
-        _state.hopefullyInSet(State::Pausing, State::Canceling, HERE);
-    } else {
-        // should not have changed
         _state.hopefullyEqualTo(State::Thinking, HERE);
+
+        ThinkerBase const & thinker = getThinker();
+
+        // A message posted to the thinker cuts the wait short, so it can be
+        // taken right away (see ThinkerInbox)
+        if ((time == 0) or thinker.hasReadyMessage())
+            return false;
+
+        // Nudges for streaming thinkers share the wait condition, so we may
+        // wake up with time still left to wait
+        unsigned long remaining = ULONG_MAX;
+        if (time != ULONG_MAX) {
+            qint64 spent = elapsed.elapsed();
+            if (spent >= static_cast<qint64>(time))
+                return false;
+            remaining = time - static_cast<unsigned long>(spent);
+        }
+
+        // A message that is counted but not linked in yet can't be taken,
+        // and returning would have a thinker that polls in a loop come
+        // straight back.  Its poster is between two instructions, so give
+        // it the processor rather than sleep.
+        if (thinker.hasMessages()) {
+            lock.unlock();
+            QThread::yieldCurrentThread();
+            lock.relock();
+            continue;
+        }
+
+        // Posters only come for the mutex to wake us if they see this flag.
+        // They count the message in with an ordered increment and then look
+        // at the flag; we set the flag the same way and then look for the
+        // message, so one side or the other is sure to see it.
+        thinker._waitingForMessages.fetchAndStoreOrdered(1);
+
+        if (not thinker.hasMessages())
+            _stateMutex.waitOn(_nudgeArrived, remaining);
+
+        thinker._waitingForMessages.storeRelease(0);
+    }
+}
+
+
+void ThinkerRunner::messagePosted () {
+    // The message is already in the inbox and the thinker said it was going
+    // to wait, so taking the mutex here means it is waiting now or will see
+    // the message before it does
+    ThinkerMutexLocker lock (&_stateMutex);
+    _nudgeArrived.wakeOne();
+}
+
+
+void ThinkerRunner::publishStatus () {
+    int status = 0;
+
+    switch (_state) {
+        case State::QueuedButPaused:
+        case State::Pausing:
+        case State::Paused:
+            status = ThinkerBase::StatusPaused;
+            break;
+        case State::Finished:
+            status = ThinkerBase::StatusFinished;
+            break;
+        case State::Canceling:
+            status = ThinkerBase::StatusCanceled;
+            break;
+        case State::Canceled:
+            status = ThinkerBase::StatusCanceled | ThinkerBase::StatusFinished;
+            break;
+        default:
+            break;
     }
 
-    return didStateChange;
+    getThinker()._status.storeRelease(status);
+
+    // Every transition comes through here, which makes it the place to
+    // trace them from
+    if (_traceTrack != 0) {
+        ThinkerTrace::endOnTrack(_traceTrack, _tracedState);
+        _tracedState = stateName(_state);
+        ThinkerTrace::beginOnTrack(_traceTrack, _tracedState);
+    }
+}
+
+
+void ThinkerRunner::nudge () {
+    // May come from any thread, including other thinkers
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    _nudged = true;
+    _nudgeArrived.wakeOne();
+}
+
+
+bool ThinkerRunner::waitForNudge (unsigned long time) const {
+    hopefullyCurrentThreadIsRun(HERE);
+
+    ThinkerMutexLocker lock (&_stateMutex);
+
+    if ((not _nudged) and (_state == State::Thinking) and (time != 0))
+        _stateMutex.waitOn(_nudgeArrived, time);
+
+    if ((_state == State::Pausing) or (_state == State::Canceling))
+        return false;
+
+    _state.hopefullyEqualTo(State::Thinking, HERE);
+
+    bool result = _nudged;
+    _nudged = false;
+    return result;
 }
 
 
@@ -642,6 +1106,11 @@ ThinkerRunner::~ThinkerRunner () {
     _state.hopefullyInSet(
         State::Canceled, State::Canceling, State::Finished, HERE
     );
+
+    if (_traceTrack != 0) {
+        ThinkerTrace::endOnTrack(_traceTrack, _tracedState);
+        ThinkerTrace::endOnTrack(_traceTrack, nullptr);
+    }
 }
 
 
@@ -650,10 +1119,15 @@ ThinkerRunner::~ThinkerRunner () {
 // ThinkerRunnerProxy
 //
 
-ThinkerRunnerProxy::ThinkerRunnerProxy (shared_ptr<ThinkerRunner> runner) :
+ThinkerRunnerProxy::ThinkerRunnerProxy (
+    shared_ptr<ThinkerRunner> runner,
+    bool isRequeue
+) :
     _runner (runner)
 {
-    getManager().addToThinkerMap(_runner);
+    if (not isRequeue)
+        getManager().addToThinkerMap(_runner);
+    THINKERQT_PROBE(enqueue, &_runner->getThinker());
 }
 
 
@@ -665,10 +1139,23 @@ ThinkerManager & ThinkerRunnerProxy::getManager () {
 void ThinkerRunnerProxy::run () {
     getManager().addToThreadMap(_runner, *QThread::currentThread());
 
-    bool wasCanceled = _runner->runThinker();
+    // A pool thread can end up running another runnable while it waits on
+    // something, so put back whatever was there rather than clearing it
+    ThinkerRunner * outerRunner = currentRunner;
+    currentRunner = _runner.get();
+
+    ThinkerRunner::Outcome outcome = _runner->runThinker();
+
+    currentRunner = outerRunner;
     getManager().removeFromThreadMap(_runner, *QThread::currentThread());
 
-    getManager().removeFromThinkerMap(_runner, wasCanceled);
+    // A parked runner stays in the thinker map, and is given a new proxy
+    // when it is resumed or canceled
+    if (outcome != ThinkerRunner::Outcome::Parked) {
+        getManager().removeFromThinkerMap(
+            _runner, outcome == ThinkerRunner::Outcome::Canceled
+        );
+    }
     // We should be cleaning up this object using auto-delete.
     hopefully(autoDelete(), HERE);
 }
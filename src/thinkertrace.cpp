@@ -0,0 +1,255 @@
+//
+// thinkertrace.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QHash>
+#include <QVector>
+#include <QThread>
+#include <QFile>
+#include <QElapsedTimer>
+
+#include "thinkerqt/thinkertrace.h"
+
+
+//
+// Per-thread ring buffers
+//
+// Only the owning thread writes to a buffer.  It fills in the slot and then
+// publishes it by bumping the count, so a reader that copies the slots and
+// then looks at the count again can tell which of them may have been
+// overwritten while it was copying.
+//
+
+namespace {
+
+struct TraceEvent {
+    qint64 nsecs;
+    quint64 track; // 0 for the thread's own track
+    char const * name;
+    char phase;
+};
+
+struct TraceBuffer {
+    enum { Capacity = 1 << 16 };
+
+    TraceBuffer (int threadId, QString const & threadName) :
+        threadId (threadId),
+        threadName (threadName),
+        written (0)
+    {
+    }
+
+    int const threadId;
+    QString const threadName;
+    QAtomicInteger<quint64> written; // ever, not just what's still held
+    TraceEvent events[Capacity]; // 2MB or so, hence always on the heap
+};
+
+// Buffers are kept until exit, even after their threads are gone, so their
+// events can still be dumped
+QMutex buffersMutex;
+QVector<TraceBuffer *> buffers; // guarded by buffersMutex
+
+QMutex tracksMutex;
+QHash<quint64, QString> trackLabels; // guarded by tracksMutex
+QAtomicInteger<quint64> lastTrack (0);
+
+QElapsedTimer traceClock; // started before tracing is first enabled
+
+thread_local TraceBuffer * threadBuffer = nullptr;
+
+
+TraceBuffer * makeThreadBuffer () {
+    QString name = QThread::currentThread()->objectName();
+
+    QMutexLocker lock (&buffersMutex);
+
+    int threadId = buffers.size() + 1;
+    if (name.isEmpty())
+        name = QString ("Thread");
+    name += QString (" #") + QString::number(threadId);
+
+    TraceBuffer * buffer = new TraceBuffer (threadId, name);
+    buffers.append(buffer);
+    return buffer;
+}
+
+
+void appendJsonString (QByteArray & out, QString const & string) {
+    out += '"';
+    for (char c : string.toUtf8()) {
+        unsigned char code = static_cast<unsigned char>(c);
+        if ((c == '"') or (c == '\\')) {
+            out += '\\';
+            out += c;
+        } else if (code < 0x20) {
+            out += "\\u00";
+            out += "0123456789abcdef"[code >> 4];
+            out += "0123456789abcdef"[code & 0xF];
+        } else {
+            out += c; // multibyte UTF-8 passes through as is
+        }
+    }
+    out += '"';
+}
+
+} // end anonymous namespace
+
+
+
+//
+// ThinkerTrace
+//
+
+QAtomicInt ThinkerTrace::_enabled (0);
+
+
+void ThinkerTrace::setEnabled (bool enabled) {
+    if (enabled) {
+        // The flag's release orders this before any thread's first event
+        QMutexLocker lock (&buffersMutex);
+        if (not traceClock.isValid())
+            traceClock.start();
+    }
+
+    _enabled.storeRelease(enabled ? 1 : 0);
+}
+
+
+void ThinkerTrace::record (char phase, char const * name, quint64 track) {
+    if (threadBuffer == nullptr)
+        threadBuffer = makeThreadBuffer();
+
+    quint64 index = threadBuffer->written.loadAcquire();
+
+    TraceEvent & event = threadBuffer->events[index % TraceBuffer::Capacity];
+    event.nsecs = traceClock.nsecsElapsed();
+    event.track = track;
+    event.name = name;
+    event.phase = phase;
+
+    threadBuffer->written.storeRelease(index + 1);
+}
+
+
+quint64 ThinkerTrace::newTrack (QString const & label) {
+    quint64 track = lastTrack.fetchAndAddOrdered(1) + 1;
+
+    QMutexLocker lock (&tracksMutex);
+    trackLabels.insert(track, label);
+    return track;
+}
+
+
+QByteArray ThinkerTrace::chromeTraceJson () {
+    QVector<TraceBuffer *> buffersCopy;
+    {
+        QMutexLocker lock (&buffersMutex);
+        buffersCopy = buffers;
+    }
+
+    QHash<quint64, QString> labelsCopy;
+    {
+        QMutexLocker lock (&tracksMutex);
+        labelsCopy = trackLabels;
+    }
+
+    QByteArray out;
+    out += "{\"traceEvents\":[\n";
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+        "\"args\":{\"name\":\"Thinker-Qt\"}}";
+
+    for (TraceBuffer * buffer : buffersCopy) {
+        QByteArray tid = QByteArray::number(buffer->threadId);
+
+        out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+        out += tid;
+        out += ",\"args\":{\"name\":";
+        appendJsonString(out, buffer->threadName);
+        out += "}}";
+
+        quint64 const capacity = TraceBuffer::Capacity;
+
+        quint64 end = buffer->written.loadAcquire();
+        quint64 begin = (end > capacity) ? end - capacity : 0;
+
+        QVector<TraceEvent> events;
+        events.reserve(static_cast<int>(end - begin));
+        for (quint64 index = begin; index < end; index++)
+            events.append(buffer->events[index % capacity]);
+
+        // The slot being written as we look again may be torn, as may any
+        // older one that has been lapped since we started copying
+        quint64 after = buffer->written.loadAcquire();
+        quint64 firstGood = (after >= capacity) ? after - capacity + 1 : 0;
+
+        for (quint64 index = qMax(begin, firstGood); index < end; index++) {
+            TraceEvent const & event = events[static_cast<int>(index - begin)];
+
+            out += ",\n{\"name\":";
+            if (event.name != nullptr)
+                appendJsonString(out, QString::fromLatin1(event.name));
+            else
+                appendJsonString(out, labelsCopy.value(event.track));
+
+            out += ",\"ph\":\"";
+            out += event.phase;
+            out += '"';
+
+            if (event.track != 0) {
+                out += ",\"cat\":\"thinker\",\"id\":\"";
+                out += QByteArray::number(event.track);
+                out += '"';
+            } else if (event.phase == 'i') {
+                out += ",\"s\":\"t\"";
+            }
+
+            // Trace-event timestamps are in microseconds
+            out += ",\"ts\":";
+            out += QByteArray::number(event.nsecs / 1000.0, 'f', 3);
+            out += ",\"pid\":1,\"tid\":";
+            out += tid;
+            out += '}';
+        }
+    }
+
+    out += "\n],\"displayTimeUnit\":\"ns\"}\n";
+    return out;
+}
+
+
+bool ThinkerTrace::saveChromeTrace (QString const & fileName) {
+    QFile file (fileName);
+    if (not file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QByteArray json = chromeTraceJson();
+    return file.write(json) == json.size();
+}
+
+
+void ThinkerTrace::clear () {
+    QMutexLocker lock (&buffersMutex);
+
+    for (TraceBuffer * buffer : buffers)
+        buffer->written.storeRelease(0);
+}
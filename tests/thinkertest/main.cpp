@@ -0,0 +1,573 @@
+//
+// main.cpp
+// This file is part of Thinker-Qt
+// Copyright (C) 2010-2014 HostileFork.com
+//
+// Thinker-Qt is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Thinker-Qt is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with Thinker-Qt.  If not, see <http://www.gnu.org/licenses/>.
+//
+// See http://hostilefork.com/thinker-qt/ for more information on this project
+//
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QVector>
+#include <QtTest>
+#include <functional>
+
+#include "thinkerqt/thinker.h"
+#include "thinkerqt/thinkermanager.h"
+#include "thinkerqt/thinkercompletionqueue.h"
+#include "thinkerqt/resultlog.h"
+#include "thinkerqt/thinkerinbox.h"
+
+//
+// thinkertest
+//
+// Checks for the lock-free structures (the listener list, ResultLog and
+// ThinkerInbox) under concurrent use, and for the manager's waits, result
+// cache and memory accounting.  Run it with "qmake && make check".  The
+// main thread is the manager thread throughout, so anything that has to
+// block runs on a Coordinator while the main thread keeps handling events.
+//
+
+namespace {
+
+class CountData : public SnapshottableData
+{
+public:
+    CountData () :
+        count (0)
+    {
+    }
+
+    int count;
+};
+
+
+// Writes as fast as it can until canceled
+class CountingThinker : public Thinker<CountData>
+{
+protected:
+    bool start () override {
+        while (not wasPauseRequested()) {
+            lockForWrite();
+            writable().count++;
+            unlock();
+        }
+        return false;
+    }
+};
+
+
+// Writes once and finishes
+class QuickThinker : public Thinker<CountData>
+{
+protected:
+    bool start () override {
+        lockForWrite();
+        writable().count = 1;
+        unlock();
+        return true;
+    }
+};
+
+
+class ResultThinker : public Thinker<CountData>
+{
+public:
+    explicit ResultThinker (int results) :
+        Thinker<CountData> (),
+        _results (results)
+    {
+    }
+
+protected:
+    bool start () override {
+        for (int index = 0; index < _results; ++index)
+            reportResult<int>(index);
+        return true;
+    }
+
+private:
+    int const _results;
+};
+
+
+// Adds up the messages posted to it until it is sent a negative one
+class SummingThinker : public Thinker<CountData>
+{
+protected:
+    bool start () override {
+        while (not wasPauseRequested(10)) {
+            int message;
+            while (takeMessage(message)) {
+                if (message < 0)
+                    return true;
+
+                lockForWrite();
+                writable().count += message;
+                unlock();
+            }
+        }
+        return false;
+    }
+};
+
+
+class KeyedThinker : public Thinker<CountData>
+{
+public:
+    explicit KeyedThinker (int key) :
+        Thinker<CountData> (),
+        _key (key)
+    {
+    }
+
+    static QAtomicInt starts;
+
+protected:
+    QByteArray cacheKey () const override {
+        return QByteArray::number(_key);
+    }
+
+    bool start () override {
+        starts.ref();
+
+        lockForWrite();
+        writable().count = _key * 10;
+        unlock();
+        return true;
+    }
+
+private:
+    int const _key;
+};
+
+QAtomicInt KeyedThinker::starts (0);
+
+
+
+//
+// Coordinator
+//
+// Runs a function on a thread of its own, as waitForAny(), waitForAll()
+// and ThinkerCompletionQueue require.  Presents belong to the thread that
+// made them, so the function should work on copies it makes itself.
+//
+
+class Coordinator : public QThread
+{
+public:
+    explicit Coordinator (std::function<void ()> body) :
+        QThread (),
+        _body (body)
+    {
+    }
+
+    void runAndPumpEvents () {
+        start();
+        while (not wait(10))
+            QCoreApplication::processEvents();
+    }
+
+protected:
+    void run () override {
+        _body();
+    }
+
+private:
+    std::function<void ()> _body;
+};
+
+
+QVector<ThinkerPresentBase> copied (
+    QVector<ThinkerPresentBase> const & presents
+) {
+    QVector<ThinkerPresentBase> result;
+    for (ThinkerPresentBase const & present : presents)
+        result.append(ThinkerPresentBase (present));
+    return result;
+}
+
+
+// Returns once the thinkers have retired, which the manager does after it
+// has queued them for the result cache
+void waitUntilRetired (QVector<ThinkerPresentBase> const & presents) {
+    bool retired = false;
+
+    Coordinator coordinator ([&] () {
+        QVector<ThinkerPresentBase> mine = copied(presents);
+        retired = ThinkerManager::getGlobalManager().waitForAll(mine, 10000);
+    });
+    coordinator.runAndPumpEvents();
+
+    QVERIFY(retired);
+    QCoreApplication::processEvents();
+}
+
+
+
+//
+// Threads for the data structure tests
+//
+
+class LogAppender : public QThread
+{
+public:
+    LogAppender (ResultLog<int> & log, int count) :
+        QThread (),
+        _log (log),
+        _count (count)
+    {
+    }
+
+protected:
+    void run () override {
+        for (int index = 0; index < _count; ++index)
+            _log.append(index);
+    }
+
+private:
+    ResultLog<int> & _log;
+    int const _count;
+};
+
+
+class InboxPoster : public QThread
+{
+public:
+    InboxPoster (ThinkerInbox<int> & inbox, int poster, int count) :
+        QThread (),
+        _inbox (inbox),
+        _poster (poster),
+        _count (count)
+    {
+    }
+
+protected:
+    void run () override {
+        for (int index = 0; index < _count; ++index)
+            _inbox.post(_poster * _count + index);
+    }
+
+private:
+    ThinkerInbox<int> & _inbox;
+    int const _poster;
+    int const _count;
+};
+
+} // end anonymous namespace
+
+
+
+class ThinkerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void listenersChurnWhileWriting ();
+
+    void resultLogReadWhileAppending ();
+
+    void resultCursorOutlivesPresent ();
+
+    void inboxManyPosters ();
+
+    void inboxMessagesReachThinker ();
+
+    void waitForAllAndAny ();
+
+    void completionQueueOrder ();
+
+    void resultCacheHit ();
+
+    void memoryHoldersDontOwn ();
+};
+
+
+void ThinkerTest::listenersChurnWhileWriting () {
+    CountingThinker::Present present = ThinkerQt::run<CountingThinker>();
+
+    // Each watcher attaches and detaches, replacing the listener list that
+    // the thinker reads on every unlock()
+    for (int round = 0; round < 2000; ++round) {
+        CountingThinker::PresentWatcher watcher (present);
+        if (round % 100 == 0)
+            QCoreApplication::processEvents();
+    }
+
+    int written = 0;
+    CountingThinker::PresentWatcher watcher (present);
+    QObject::connect(
+        &watcher, &ThinkerPresentWatcherBase::written,
+        [&written] () { written++; }
+    );
+    QTRY_VERIFY(written > 0);
+
+    quint64 version = present.version();
+    QTRY_VERIFY(present.version() > version);
+
+    present.cancel();
+    present.waitForFinished();
+    QVERIFY(present.isCanceled());
+}
+
+
+void ThinkerTest::resultLogReadWhileAppending () {
+    // Enough to go through a dozen chunks
+    int const count = 200000;
+
+    shared_ptr<ResultLog<int>> log = make_shared<ResultLog<int>>();
+    QAtomicPointer<ResultLogBase> slot (nullptr);
+
+    // Made before there is anything to read
+    ResultLog<int>::Cursor cursor (log, slot);
+    QCOMPARE(cursor.available(), 0);
+
+    LogAppender appender (*log, count);
+    slot.storeRelease(log.get());
+    appender.start();
+
+    int expected = 0;
+    while (expected < count) {
+        while (cursor.hasNext()) {
+            int item = cursor.next();
+            if (item != expected)
+                QCOMPARE(item, expected);
+            expected++;
+        }
+    }
+
+    QVERIFY(appender.wait(10000));
+    QCOMPARE(log->count(), count);
+    QCOMPARE(cursor.position(), count);
+}
+
+
+void ThinkerTest::resultCursorOutlivesPresent () {
+    ResultLog<int>::Cursor cursor;
+    {
+        ResultThinker::Present present = ThinkerQt::run<ResultThinker>(1000);
+        present.waitForFinished();
+        QCOMPARE(present.resultCount(), 1000);
+
+        cursor = present.resultCursor<int>();
+    }
+    QCoreApplication::processEvents();
+
+    int expected = 0;
+    while (cursor.hasNext())
+        QCOMPARE(cursor.next(), expected++);
+    QCOMPARE(expected, 1000);
+}
+
+
+void ThinkerTest::inboxManyPosters () {
+    int const posters = 4;
+    int const count = 50000;
+
+    QAtomicPointer<ThinkerInboxBase> slot (nullptr);
+    ThinkerInbox<int> * inbox = ThinkerInbox<int>::ensure(slot);
+    unique_ptr<ThinkerInboxBase> owner (inbox);
+
+    QVector<InboxPoster *> threads;
+    for (int poster = 0; poster < posters; ++poster)
+        threads.append(new InboxPoster (*inbox, poster, count));
+    for (InboxPoster * thread : threads)
+        thread->start();
+
+    // Each poster's messages must come out in the order it sent them
+    QVector<int> next (posters, 0);
+    int taken = 0;
+    while (taken < posters * count) {
+        if (inbox->pendingCount() < 0)
+            QVERIFY(inbox->pendingCount() >= 0);
+
+        int message;
+        if (not inbox->take(message))
+            continue;
+
+        int poster = message / count;
+        if (message % count != next[poster])
+            QCOMPARE(message % count, next[poster]);
+        next[poster]++;
+        taken++;
+    }
+
+    for (InboxPoster * thread : threads) {
+        QVERIFY(thread->wait(10000));
+        delete thread;
+    }
+
+    int message;
+    QVERIFY(not inbox->take(message));
+    QCOMPARE(inbox->pendingCount(), 0);
+}
+
+
+void ThinkerTest::inboxMessagesReachThinker () {
+    SummingThinker::Present present = ThinkerQt::run<SummingThinker>();
+
+    for (int message = 1; message <= 100; ++message)
+        present.postMessage(message);
+    present.postMessage(-1);
+
+    present.waitForFinished();
+    QVERIFY(not present.isCanceled());
+    QCOMPARE(present.createSnapshot()->count, 5050);
+}
+
+
+void ThinkerTest::waitForAllAndAny () {
+    QVector<ThinkerPresentBase> quick;
+    for (int index = 0; index < 8; ++index)
+        quick.append(ThinkerQt::run<QuickThinker>());
+
+    CountingThinker::Present busy = ThinkerQt::run<CountingThinker>();
+
+    QVector<ThinkerPresentBase> justBusy (1, busy);
+
+    QVector<ThinkerPresentBase> busyThenQuick (justBusy);
+    busyThenQuick.append(quick.first());
+
+    bool allDone = false;
+    int anyDone = -2;
+    int busyDone = -2;
+
+    Coordinator coordinator ([&] () {
+        ThinkerManager & mgr = ThinkerManager::getGlobalManager();
+
+        QVector<ThinkerPresentBase> mine = copied(quick);
+        allDone = mgr.waitForAll(mine, 10000);
+
+        mine = copied(busyThenQuick);
+        anyDone = mgr.waitForAny(mine, 10000);
+
+        mine = copied(justBusy);
+        busyDone = mgr.waitForAny(mine, 50);
+    });
+    coordinator.runAndPumpEvents();
+
+    QVERIFY(allDone);
+    QCOMPARE(anyDone, 1);
+    QCOMPARE(busyDone, -1);
+
+    busy.cancel();
+    busy.waitForFinished();
+}
+
+
+void ThinkerTest::completionQueueOrder () {
+    QVector<ThinkerPresentBase> presents;
+    for (int index = 0; index < 3; ++index)
+        presents.append(ThinkerQt::run<QuickThinker>());
+
+    CountingThinker::Present busy = ThinkerQt::run<CountingThinker>();
+    presents.append(busy);
+
+    int retired = 0;
+    bool timedOut = false;
+    int pending = -1;
+
+    Coordinator coordinator ([&] () {
+        ThinkerCompletionQueue queue;
+        for (ThinkerPresentBase const & present : copied(presents))
+            queue.addPresent(present);
+
+        for (int index = 0; index < 3; ++index) {
+            if (queue.takeRetired(10000) != ThinkerPresentBase ())
+                retired++;
+        }
+
+        timedOut = (queue.takeRetired(50) == ThinkerPresentBase ());
+        pending = queue.pendingCount();
+    });
+    coordinator.runAndPumpEvents();
+
+    QCOMPARE(retired, 3);
+    QVERIFY(timedOut);
+    QCOMPARE(pending, 1);
+
+    busy.cancel();
+    busy.waitForFinished();
+}
+
+
+void ThinkerTest::resultCacheHit () {
+    ThinkerManager & mgr = ThinkerManager::getGlobalManager();
+    mgr.setResultCacheBudget(1 << 20);
+
+    {
+        KeyedThinker::Present first = ThinkerQt::run<KeyedThinker>(7);
+        waitUntilRetired(QVector<ThinkerPresentBase> (1, first));
+        QCOMPARE(first.createSnapshot()->count, 70);
+    }
+    QCoreApplication::processEvents();
+
+    int starts = KeyedThinker::starts.loadAcquire();
+
+    // The hit is a thinker of its own, finished before run() returns
+    KeyedThinker::Present second = ThinkerQt::run<KeyedThinker>(7);
+    QVERIFY(second.isFinished());
+    QVERIFY(not second.isCanceled());
+    QCOMPARE(second.createSnapshot()->count, 70);
+    QCOMPARE(KeyedThinker::starts.loadAcquire(), starts);
+
+    // Canceling a finished thinker does nothing
+    second.cancel();
+    QVERIFY(not second.isCanceled());
+
+    // A different key is a miss
+    KeyedThinker::Present third = ThinkerQt::run<KeyedThinker>(8);
+    third.waitForFinished();
+    QCOMPARE(third.createSnapshot()->count, 80);
+    QCOMPARE(KeyedThinker::starts.loadAcquire(), starts + 1);
+
+    mgr.setResultCacheBudget(0);
+    mgr.clearResultCache();
+}
+
+
+void ThinkerTest::memoryHoldersDontOwn () {
+    ThinkerManager & mgr = ThinkerManager::getGlobalManager();
+
+    std::weak_ptr<ThinkerBase const> handle;
+    {
+        QuickThinker::Present present = ThinkerQt::run<QuickThinker>();
+        waitUntilRetired(QVector<ThinkerPresentBase> (1, present));
+
+        SnapshottableMemoryUsage total = mgr.memoryUsage();
+        QVERIFY(total.currentBytes >= qint64(sizeof(CountData)));
+
+        for (ThinkerManager::MemoryHolder const & holder
+            : mgr.largestMemoryHolders(-1)
+        ) {
+            shared_ptr<ThinkerBase const> thinker = holder.thinker.lock();
+            if (thinker.get() != &mgr.getThinkerBase(present))
+                continue;
+
+            QVERIFY(holder.usage.currentBytes >= qint64(sizeof(CountData)));
+            handle = holder.thinker;
+        }
+        QVERIFY(not handle.expired());
+    }
+
+    // The report doesn't keep the thinker, so it goes with its Present
+    QTRY_VERIFY(handle.expired());
+}
+
+
+QTEST_GUILESS_MAIN(ThinkerTest)
+
+#include "main.moc"
@@ -0,0 +1,12 @@
+QT       += core testlib
+QT       -= gui
+
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+
+TARGET = thinkertest
+TEMPLATE = app
+
+SOURCES       = main.cpp
+
+include(../../thinkerqt.pri)
@@ -0,0 +1,51 @@
+# Thinker-Qt is built into each program that uses it rather than as a
+# library of its own.  Include this from a .pro file to add its sources,
+# headers and include path:
+#
+#     include(../../thinkerqt.pri)
+
+THINKER_SRC = $$PWD/src
+THINKER_INC = $$PWD/include/thinkerqt
+
+SOURCES     += $$THINKER_SRC/signalthrottler.cpp  \
+               $$THINKER_SRC/snapshottable.cpp \
+               $$THINKER_SRC/thinker.cpp \
+               $$THINKER_SRC/thinkermanager.cpp \
+               $$THINKER_SRC/thinkerpresent.cpp \
+               $$THINKER_SRC/thinkerpresentwatcher.cpp \
+               $$THINKER_SRC/thinkerrunner.cpp \
+               $$THINKER_SRC/thinkereventnotifier.cpp \
+               $$THINKER_SRC/thinkergroupwatcher.cpp \
+               $$THINKER_SRC/thinkergraph.cpp \
+               $$THINKER_SRC/thinkercompletionqueue.cpp \
+               $$THINKER_SRC/thinkertrace.cpp \
+               $$THINKER_SRC/thinkerlockprofile.cpp
+
+HEADERS     += $$THINKER_INC/signalthrottler.h \
+               $$THINKER_INC/thinker.h \
+               $$THINKER_INC/thinkermanager.h \
+               $$THINKER_INC/thinkerpresentwatcher.h \
+               $$THINKER_INC/thinkerlistener.h \
+               $$THINKER_INC/resultlog.h \
+               $$THINKER_INC/thinkerinbox.h \
+               $$THINKER_INC/thinkermetrics.h \
+               $$THINKER_INC/thinkertrace.h \
+               $$THINKER_INC/thinkerlockprofile.h \
+               $$THINKER_INC/thinkerprobes.h \
+               $$THINKER_INC/latencyhistogram.h \
+               $$THINKER_INC/thinkereventnotifier.h \
+               $$THINKER_INC/thinkergroupwatcher.h \
+               $$THINKER_INC/thinkergraph.h \
+               $$THINKER_INC/thinkercompletionqueue.h \
+               $$THINKER_INC/thinkerrunner.h
+
+INCLUDEPATH += $$PWD/include
+QMAKE_CXXFLAGS += -std=c++0x
+
+# "qmake CONFIG+=thinkerqt_no_checks" builds with the library's assertions
+# and thread checks compiled out, for comparing against a normal build
+thinkerqt_no_checks: DEFINES += THINKERQT_NO_CHECKS=1
+
+# "qmake CONFIG+=thinkerqt_usdt" builds in the USDT probes (Linux, needs
+# <sys/sdt.h>), for attaching perf or tools/bpftrace scripts at runtime
+thinkerqt_usdt: DEFINES += THINKERQT_USDT=1